@@ -28,6 +28,7 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #define si_swap(a, b, type) \
     do {                    \
@@ -48,68 +49,93 @@ hl_u8(u8 high, u8 low)
     return (high << 8) | low;
 }
 
+// Slow path, only reached for pages with a trap on them.
 internal void
-unimplemented_instruction(cpu_8080 *cpu, u8 instruction)
+trap_hit(struct cpu_8080 *cpu, u16 addr, u8 access)
 {
-    printf("Error: unimplemented instruction: 0x%02x\n", instruction);
-    assert(0);
-    // exit(1);
+    if ((cpu->traps->addrs[addr] & access) && !cpu->trapHit) {
+        cpu->trapHit = 1;
+        cpu->trapAddr = addr;
+        cpu->trapAccess = access;
+    }
 }
 
-internal inline u8
-parity(u16 f)
+// splitmix64 finalizer
+internal inline u64
+hash_mix(u64 x)
 {
-    int parity = __builtin_popcount(f);
-    return (parity & 1) == 0;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
 }
 
-internal inline void
-update_addsub_flags(struct cpu_8080 *cpu, u16 val)
+internal inline u64
+hash_byte(u16 addr, u8 val)
 {
-    cpu->cc.z = (val & 0xff) == 0;
-    cpu->cc.s = (val & 0x80) != 0;
-    cpu->cc.cy = val > 0xff;
-    cpu->cc.p = parity(val & 0xff);
+    return hash_mix(((u64)addr << 8) | val);
 }
 
+// Swaps the old value at addr out of the hash for val. Memory past hash->memSize
+// isn't part of the hash.
 internal inline void
-update_increment_flags(struct cpu_8080 *cpu, u8 val)
+hash_store(struct cpu_8080 *cpu, u16 addr, u8 val)
 {
-    cpu->cc.z = val == 0;
-    cpu->cc.s = (val & 0x80) != 0;
-    cpu->cc.p = parity(val);
+    if (addr >= cpu->hash->memSize) return;
+    u64 delta = hash_byte(addr, cpu->m[addr]) ^ hash_byte(addr, val);
+    cpu->hash->pages[addr >> 8] ^= delta;
+    cpu->hash->mem ^= delta;
 }
 
+// Stores made outside the engines, see CORE_FN(write) in c8080_core.inl.
 internal inline void
-update_logical_flags(struct cpu_8080 *cpu, u8 val)
+write_u8(struct cpu_8080 *cpu, u16 addr, u8 val)
 {
-    cpu->cc.z = (val & 0xff) == 0;
-    cpu->cc.s = (val & 0x80) != 0;
-    cpu->cc.cy = 0;
-    cpu->cc.ac = 0;
-    cpu->cc.p = parity(val);
+    if (cpu->traps && (cpu->traps->pages[addr >> 8] & TRAP_WRITE)) trap_hit(cpu, addr, TRAP_WRITE);
+    if (cpu->hash) hash_store(cpu, addr, val);
+    cpu->m[addr] = val;
 }
 
-internal inline void
-ret(struct cpu_8080 *cpu)
+internal run_result
+watch_stop(struct cpu_8080 *cpu)
 {
-    cpu->pc = ((cpu->m[cpu->sp + 1] << 8) | (cpu->m[cpu->sp + 0]));
-    cpu->sp += 2;
+    run_result result = {0};
+    cpu->trapHit = 0;
+    result.reason = cpu->trapAccess == TRAP_READ ? STOP_WATCH_READ : STOP_WATCH_WRITE;
+    result.addr = cpu->trapAddr;
+    result.access = cpu->trapAccess;
+    return result;
 }
-internal inline void
-call(struct cpu_8080 *cpu, u16 addr)
+
+internal void
+unimplemented_instruction(cpu_8080 *cpu, u8 instruction)
 {
-    u16 ret = cpu->pc + 2;
-    cpu->m[cpu->sp - 1] = (ret >> 8) & 0xff;
-    cpu->m[cpu->sp - 2] = (ret & 0xff);
-    cpu->pc = addr - 1;
-    cpu->sp -= 2;
+    printf("Error: unimplemented instruction: 0x%02x\n", instruction);
+    assert(0);
+    // exit(1);
+}
+
+internal inline u8
+parity(u16 f)
+{
+    int parity = __builtin_popcount(f);
+    return (parity & 1) == 0;
 }
 
+// Builds the whole flag byte and stores it once, instead of a read-modify-write
+// for every bitfield.
 internal inline void
-call_hl(struct cpu_8080 *cpu, u8 addrLow, u8 addrHigh)
+update_flags(struct cpu_8080 *cpu, u8 result, u8 cy, u8 ac)
 {
-    call(cpu, hl_u8(addrHigh, addrLow));
+    condition_codes cc = {0};
+    cc.z = result == 0;
+    cc.s = (result & 0x80) != 0;
+    cc.p = parity(result);
+    cc.cy = cy;
+    cc.ac = ac;
+    cpu->cc = cc;
 }
 
 internal inline void
@@ -118,20 +144,25 @@ jmp_hl(struct cpu_8080 *cpu, u8 addrLow, u8 addrHigh)
     cpu->pc = hl_u8(addrHigh, addrLow) - 1;
 }
 
+// The 8080 subtracts by adding the complement, so AC is the carry out of bit 3 of
+// reg0 + ~reg1 + !borrow.
+internal inline u8
+sub_aux_carry(u8 reg0, u8 reg1, u8 borrow)
+{
+    return ((reg0 & 0x0f) + (~reg1 & 0x0f) + !borrow) > 0x0f;
+}
+
 internal inline void cmp(struct cpu_8080 *cpu, u8 reg0, u8 reg1)
 {
     u8 result = reg0 - reg1;
-    cpu->cc.z = (reg0 == reg1);
-    cpu->cc.cy = (reg0 < reg1);
-    cpu->cc.s = (result & 0x80) != 0;
-    cpu->cc.p = parity(result);
+    update_flags(cpu, result, reg0 < reg1, sub_aux_carry(reg0, reg1, 0));
 }
 
 internal inline u8
 bitwise_and(struct cpu_8080 *cpu, u8 reg0, u8 reg1)
 {
     u8 result = reg0 & reg1;
-    update_logical_flags(cpu, result);
+    update_flags(cpu, result, 0, ((reg0 | reg1) & 0x08) != 0); // AC is 8080 specific, the 8085 always sets it
     return result;
 }
 
@@ -139,7 +170,7 @@ internal inline u8
 bitwise_or(struct cpu_8080 *cpu, u8 reg0, u8 reg1)
 {
     u8 result = reg0 | reg1;
-    update_logical_flags(cpu, result);
+    update_flags(cpu, result, 0, 0);
     return result;
 }
 
@@ -147,7 +178,7 @@ internal inline u8
 bitwise_xor(struct cpu_8080 *cpu, u8 reg0, u8 reg1)
 {
     u8 result = reg0 ^ reg1;
-    update_logical_flags(cpu, result);
+    update_flags(cpu, result, 0, 0);
     return result;
 }
 
@@ -155,7 +186,7 @@ internal inline u8
 increment(struct cpu_8080 *cpu, u8 val)
 {
     u8 result = val + 1;
-    update_increment_flags(cpu, result);
+    update_flags(cpu, result, cpu->cc.cy, (result & 0x0f) == 0);
     return result;
 }
 
@@ -163,7 +194,7 @@ internal inline u8
 decrement(struct cpu_8080 *cpu, u8 val)
 {
     u8 result = val - 1;
-    update_increment_flags(cpu, result);
+    update_flags(cpu, result, cpu->cc.cy, (result & 0x0f) != 0x0f);
     return result;
 }
 
@@ -171,7 +202,7 @@ internal inline u8
 add(struct cpu_8080 *cpu, u8 val0, u8 val1)
 {
     u16 result = (u16)val0 + (u16)val1;
-    update_addsub_flags(cpu, result);
+    update_flags(cpu, result, result > 0xff, ((val0 ^ val1 ^ result) & 0x10) != 0);
     return result & 0xff;
 }
 
@@ -179,7 +210,7 @@ internal inline u8
 sub(struct cpu_8080 *cpu, u8 val0, u8 val1)
 {
     u16 result = (u16)val0 - (u16)val1;
-    update_addsub_flags(cpu, result);
+    update_flags(cpu, result, result > 0xff, sub_aux_carry(val0, val1, 0));
     return result & 0xff;
 }
 
@@ -187,40 +218,35 @@ internal inline u8
 carry_add(struct cpu_8080 *cpu, u8 val0, u8 val1)
 {
     u16 result = (u16)val0 + (u16)val1 + (u16)cpu->cc.cy;
-    update_addsub_flags(cpu, result);
+    update_flags(cpu, result, result > 0xff, ((val0 ^ val1 ^ result) & 0x10) != 0);
     return result & 0xff;
 }
 
 internal inline u8
 carry_sub(struct cpu_8080 *cpu, u8 val0, u8 val1)
 {
-    u16 result = (u16)val0 - (u16)val1 - (u16)cpu->cc.cy;
-    update_addsub_flags(cpu, result);
+    u8 borrow = cpu->cc.cy;
+    u16 result = (u16)val0 - (u16)val1 - (u16)borrow;
+    update_flags(cpu, result, result > 0xff, sub_aux_carry(val0, val1, borrow));
     return result & 0xff;
 }
 
 internal inline void
-stack_push_u16(struct cpu_8080 *cpu, u16 val)
-{
-    cpu->m[cpu->sp - 1] = (val & 0xff00) >> 8;
-    cpu->m[cpu->sp - 2] = (val & 0xff);
-    cpu->sp -= 2;
-}
-
-internal inline void
-stack_push_u8_hl(struct cpu_8080 *cpu, u8 high, u8 low)
+daa(struct cpu_8080 *cpu)
 {
-    cpu->m[cpu->sp - 1] = high;
-    cpu->m[cpu->sp - 2] = low;
-    cpu->sp -= 2;
-}
-
-internal inline void
-stack_pop_u8_hl(struct cpu_8080 *cpu, u8 *regH, u8 *regL)
-{
-    *regL = cpu->m[cpu->sp + 0];
-    *regH = cpu->m[cpu->sp + 1];
-    cpu->sp += 2;
+    u8 lsb = cpu->a & 0x0f;
+    u8 msb = cpu->a >> 4;
+    u8 cy = cpu->cc.cy;
+    u8 correction = 0;
+    if (cpu->cc.ac || lsb > 9) {
+        correction += 0x06;
+    }
+    if (cy || msb > 9 || (msb >= 9 && lsb > 9)) {
+        correction += 0x60;
+        cy = 1;
+    }
+    cpu->a = add(cpu, cpu->a, correction);
+    cpu->cc.cy = cy;
 }
 
 internal inline void
@@ -237,419 +263,410 @@ dad(struct cpu_8080 *cpu, u8 regH, u8 regL)
 internal inline void
 generate_interrupt(struct cpu_8080 *cpu, i32 interruptNum)
 {
-    stack_push_u16(cpu, cpu->pc);
+    // A halted cpu wakes up and returns past the HLT.
+    u16 ret = cpu->pc + (cpu->halted && cpu->m[cpu->pc] == 0x76);
+    cpu->halted = 0;
+    write_u8(cpu, cpu->sp - 1, ret >> 8);
+    write_u8(cpu, cpu->sp - 2, ret & 0xff);
+    cpu->sp -= 2;
     cpu->pc = 8 * interruptNum; // RST [interrupt number]
+    cpu->interruptEnabled = 0;
 }
 
+// Log file layout: "C8IO" followed by a version byte, then one record per event:
+//   varint  step delta since the previous record (7 bits per byte, low bits first)
+//   u8      kind
+//   u8      port / interrupt number
+//   u8      value (IN only)
+#define IO_LOG_VERSION 1
+
+// Records are flushed to the file at least this often, so a process that dies
+// loses at most this many.
+#define IO_LOG_FLUSH_INTERVAL 256
+
+internal void
+io_log_push(io_log *log, io_event event)
+{
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 1024;
+        io_event *events = realloc(log->events, capacity * sizeof(io_event));
+        assert(events);
+        log->events = events;
+        log->capacity = capacity;
+    }
+    log->events[log->count++] = event;
+
+    if (log->file) {
+        u64 delta = event.step - log->fileStep;
+        log->fileStep = event.step;
+        do {
+            u8 byte = delta & 0x7f;
+            delta >>= 7;
+            fputc(byte | (delta ? 0x80 : 0), log->file);
+        } while (delta);
+        fputc(event.kind, log->file);
+        fputc(event.port, log->file);
+        if (event.kind == IO_EVENT_IN) fputc(event.value, log->file);
+        if (++log->unflushed >= IO_LOG_FLUSH_INTERVAL) {
+            fflush(log->file);
+            log->unflushed = 0;
+        }
+    }
+}
+
+internal inline u8
+port_in(struct cpu_8080 *cpu, u8 port)
+{
+    io_log *log = cpu->log;
+    if (log && log->mode == IO_LOG_REPLAY) {
+        io_event *e = log->cursor < log->count ? &log->events[log->cursor] : NULL;
+        if (!e || e->kind != IO_EVENT_IN || e->step != cpu->steps || e->port != port) {
+            printf("Error: replay desync at step %llu (IN 0x%02x)\n", (unsigned long long)cpu->steps, port);
+            log->desync = 1;
+            return 0;
+        }
+        log->cursor++;
+        return e->value;
+    }
+
+    u8 val = cpu->in ? cpu->in(cpu, port) : 0;
+    if (log && log->mode == IO_LOG_RECORD) {
+        io_event e = { cpu->steps, IO_EVENT_IN, port, val };
+        io_log_push(log, e);
+    }
+    return val;
+}
+
+internal inline void
+port_out(struct cpu_8080 *cpu, u8 port, u8 val)
+{
+    // Devices are not emulated during replay, their inputs are in the log.
+    if (cpu->out && !(cpu->log && cpu->log->mode == IO_LOG_REPLAY)) {
+        cpu->out(cpu, port, val);
+    }
+}
+
+internal void
+replay_interrupts(struct cpu_8080 *cpu)
+{
+    io_log *log = cpu->log;
+    while (log->cursor < log->count) {
+        io_event *e = &log->events[log->cursor];
+        if (e->kind != IO_EVENT_INTERRUPT || e->step != cpu->steps) break;
+        generate_interrupt(cpu, e->port);
+        log->cursor++;
+    }
+    if (log->cursor == log->count && cpu->steps >= log->resumeStep) {
+        log->mode = IO_LOG_RECORD;
+    }
+}
+
+int
+interrupt_8080(struct cpu_8080 *cpu, int interruptNum)
+{
+    io_log *log = cpu->log;
+    if (!cpu->interruptEnabled || (log && log->mode == IO_LOG_REPLAY)) return 0;
+
+    if (log && log->mode == IO_LOG_RECORD) {
+        io_event e = { cpu->steps, IO_EVENT_INTERRUPT, (u8)interruptNum, 0 };
+        io_log_push(log, e);
+    }
+    generate_interrupt(cpu, interruptNum);
+    return 1;
+}
+
+int
+io_log_record(struct cpu_8080 *cpu, io_log *log, const char *path)
+{
+    *log = (io_log){0};
+    if (path) {
+        log->file = fopen(path, "wb");
+        if (!log->file) return 0;
+        fwrite("C8IO", 1, 4, log->file);
+        fputc(IO_LOG_VERSION, log->file);
+    }
+    log->mode = IO_LOG_RECORD;
+    log->fileStep = cpu->steps;
+    cpu->log = log;
+    return 1;
+}
+
+int
+io_log_replay(struct cpu_8080 *cpu, io_log *log, const char *path)
+{
+    *log = (io_log){0};
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+
+    char magic[5];
+    if (fread(magic, 1, 5, f) != 5 || memcmp(magic, "C8IO", 4) != 0 || magic[4] != IO_LOG_VERSION) {
+        fclose(f);
+        return 0;
+    }
+
+    // The first delta is relative to the step recording started at, which is
+    // the step replay has to start at as well. A record cut off by the end of the
+    // file is what a recording process that died leaves behind, so everything
+    // before it is kept.
+    u64 step = cpu->steps;
+    for (;;) {
+        int c = fgetc(f);
+        if (c == EOF) break;
+
+        u64 delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (c == EOF) goto truncated;
+            if (shift > 63) goto corrupt;
+            delta |= (u64)(c & 0x7f) << shift;
+            if (!(c & 0x80)) break;
+            c = fgetc(f);
+        }
+        step += delta;
+
+        io_event e = { step, 0, 0, 0 };
+        int kind = fgetc(f);
+        int port = fgetc(f);
+        int value = kind == IO_EVENT_IN ? fgetc(f) : 0;
+        if (kind == EOF || port == EOF || value == EOF) goto truncated;
+        if (kind != IO_EVENT_IN && kind != IO_EVENT_INTERRUPT) goto corrupt;
+        e.kind = kind;
+        e.port = port;
+        e.value = value;
+        io_log_push(log, e);
+        continue;
+
+    truncated:
+        log->truncated = 1;
+        break;
+    }
+    fclose(f);
+
+    log->mode = IO_LOG_REPLAY;
+    log->resumeStep = UINT64_MAX;
+    cpu->log = log;
+    return 1;
+
+corrupt:
+    fclose(f);
+    free(log->events);
+    *log = (io_log){0};
+    return 0;
+}
+
+void
+io_log_discard(io_log *log, size_t n)
+{
+    if (n > log->count) n = log->count;
+    log->count -= n;
+    memmove(log->events, log->events + n, log->count * sizeof(io_event));
+    log->cursor = log->cursor > n ? log->cursor - n : 0;
+
+    // Give the memory back too, keeping at most twice what is used like
+    // io_log_push does.
+    if (log->capacity > 1024 && log->count <= log->capacity / 2) {
+        size_t capacity = log->capacity / 2;
+        while (capacity > 1024 && log->count <= capacity / 2) capacity /= 2;
+        io_event *events = realloc(log->events, capacity * sizeof(io_event));
+        if (events) {
+            log->events = events;
+            log->capacity = capacity;
+        }
+    }
+}
+
+void
+io_log_close(struct cpu_8080 *cpu, io_log *log)
+{
+    if (log->file) fclose(log->file);
+    free(log->events);
+    *log = (io_log){0};
+    if (cpu->log == log) cpu->log = NULL;
+}
+
+// Base cycle count of every opcode. Conditional calls and returns take 6 more when
+// the condition holds.
+// clang-format off
+internal const u8 cycles_8080[256] = {
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x00
+    4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4, // 0x10
+    4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4, // 0x20
+    4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4, // 0x30
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x40
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x50
+    5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5, // 0x60
+    7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5, // 0x70
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x80
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x90
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xa0
+    4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xb0
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xc0
+    5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11, // 0xd0
+    5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // 0xe0
+    5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11, // 0xf0
+};
+// clang-format on
+
+// Engines, see c8080_core.inl. step_hooked supports everything a host can attach to
+// the cpu. step_trapped only checks traps, for debuggers that set breakpoints and
+// nothing else. With nothing attached, step_timed is used if the host wants cycles
+// and step_flat, the bare core, otherwise.
+#define CORE_STEP step_hooked
+#define CORE_RUN run_hooked
+#define CORE_TRAPS 1
+#define CORE_HASH 1
+#define CORE_IO_LOG 1
+#define CORE_CYCLES 1
+#define CORE_TRACE 1
+#include "c8080_core.inl"
+
+#define CORE_STEP step_trapped
+#define CORE_TRAPS 1
+#define CORE_HASH 0
+#define CORE_IO_LOG 0
+#define CORE_CYCLES 0
+#define CORE_TRACE 0
+#include "c8080_core.inl"
+
+#define CORE_STEP step_timed
+#define CORE_RUN run_timed
+#define CORE_TRAPS 0
+#define CORE_HASH 0
+#define CORE_IO_LOG 0
+#define CORE_CYCLES 1
+#define CORE_TRACE 0
+#include "c8080_core.inl"
+
+#define CORE_STEP step_flat
+#define CORE_RUN run_flat
+#define CORE_TRAPS 0
+#define CORE_HASH 0
+#define CORE_IO_LOG 0
+#define CORE_CYCLES 0
+#define CORE_TRACE 0
+#include "c8080_core.inl"
+
+// Kept out of line so emulate_8080 is only the checks and an inlined step_flat.
+#if defined(_MSC_VER)
+__declspec(noinline)
+#elif defined(__GNUC__)
+__attribute__((noinline))
+#endif
+internal int
+step_attached(struct cpu_8080 *cpu)
+{
+    // Breakpoints only matter to run_8080, only watchpoints need checked accesses.
+    if (cpu->log || cpu->hash || cpu->trace) return step_hooked(cpu);
+    if (cpu->traps && (cpu->traps->all & (TRAP_READ | TRAP_WRITE))) {
+        return cpu->countCycles ? step_hooked(cpu) : step_trapped(cpu);
+    }
+    return cpu->countCycles ? step_timed(cpu) : step_flat(cpu);
+}
 
 int //Returns 0 when exit is called. Returns 1 otherwise
 emulate_8080(struct cpu_8080 *cpu)
 {
-    u8 *oc = &cpu->m[cpu->pc];
-
-    // clang-format off
-    switch (*oc) {
-
-        case 0x00: break; // NOP
-        case 0x08: break; // NOP
-        case 0x10: break; // NOP
-        case 0x18: break; // NOP
-        case 0x20: break; // NOP
-        case 0x28: break; // NOP
-        case 0x30: break; // NOP
-        case 0x38: break; // NOP
-        case 0xcb: break; // NOP
-        case 0xd9: break; // NOP
-        case 0xdd: break; // NOP
-        case 0xed: break; // NOP
-        case 0xfd: break; // NOP
-
-        case 0x02: { //STAX B
-            cpu->m[hl_u8(cpu->b, cpu->c)] = cpu->a;
-        } break;
-        case 0x12: { //STAX D
-            cpu->m[hl_u8(cpu->d, cpu->e)] = cpu->a;
-        } break;
-        case 0x32: { //STA addr 
-            cpu->m[hl_u8(oc[2], oc[1])] = cpu->a;
-            cpu->pc += 2;
-        } break;
-
-        case 0x0a: { //LDAX B
-            u16 addr = hl_u8(cpu->b, cpu->c);
-            cpu->a = cpu->m[addr];
-        } break;
-        case 0x1a: { //LDAX D
-            u16 addr = hl_u8(cpu->d, cpu->e);
-            cpu->a = cpu->m[addr];
-        } break;
-        case 0x3a: { //LDA addr 
-            u16 addr = hl_u8(oc[2], oc[1]);
-            cpu->a = cpu->m[addr];
-            cpu->pc += 2;
-        } break;
-
-        case 0x22: { //SHLD addr
-            u16 addr = hl_u8(oc[2], oc[1]);
-            cpu->m[addr+0] = cpu->l;
-            cpu->m[addr+1] = cpu->h;
-            cpu->pc += 2;
-        } break;
-
-        case 0x2a: { //LHLD addr
-            u16 addr = hl_u8(oc[2], oc[1]);
-            cpu->l = cpu->m[addr+0];
-            cpu->h = cpu->m[addr+1];
-            cpu->pc += 2;
-        } break;
-
-        case 0x07: {  //RLC (A = A << 1; bit 0 = prev bit 7; CY = prev bit 7)
-            u8 result = cpu->a << 1;
-            u8 bit7 = cpu->a >> 7;
-            cpu->cc.cy = bit7;
-            cpu->a = result | bit7; 
-        } break;
-
-        case 0x0f: { //RRC (A = A >> 1; bit 7 = prev bit 0; CY = prev bit 0)
-            //shift
-            u8 result = cpu->a >> 1;
-            u8 bit0 = (cpu->a & 0x01);
-            cpu->cc.cy = bit0;
-            cpu->a = result | (bit0 << 7);
-        } break;
-
-        case 0x17: { //RAL (A = A << 1; bit0 = prev CY; CY = prev bit 7)
-            u8 result = (cpu->a << 1) | cpu->cc.cy;
-            cpu->cc.cy = cpu->a >> 7;
-            cpu->a = result;
-        } break;
-
-        case 0x1f: { //RAR (A = A >> 1; bit 7 = prev bit 7; CY = prev bit 0)
-            u8 result = cpu->a >> 1;
-            u8 bit7 = cpu->a & 0x80;
-            cpu->cc.cy = cpu->a & 0x01; 
-            cpu->a = result | bit7;
-        } break;
-
-        case 0x2f: /* CMA */ cpu->a = ~cpu->a; break; 
-        case 0x3f: /* CMC */ cpu->cc.cy = !cpu->cc.cy; break;
-        case 0x37: /* STC */ cpu->cc.cy = 1; break;
-
-        case 0x01: { // LXI B,word
-            cpu->c = oc[1];
-            cpu->b = oc[2];
-            cpu->pc += 2;
-        } break;
-        case 0x11: { // LXI D,word
-            cpu->e = oc[1];
-            cpu->d = oc[2];
-            cpu->pc += 2;
-        } break;
-        case 0x21: { // LXI H,word
-            cpu->l = oc[1];
-            cpu->h = oc[2];
-            cpu->pc += 2;
-        } break;
-        case 0x31: { // LXI SP,word
-            cpu->sp = hl_u8(oc[2], oc[1]);
-            cpu->pc += 2;
-        } break;
-
-        case 0x03: { // INX B
-            u16 bc = hl_u8(cpu->b, cpu->c);
-            ++bc;
-            cpu->b = bc >> 8;
-            cpu->c = bc & 0xff;
-        } break;
-        case 0x13: { // INX D
-            u16 de = hl_u8(cpu->d, cpu->e);
-            ++de;
-            cpu->d = de >> 8;
-            cpu->e = de & 0xff;
-        } break;
-        case 0x23: { // INX H
-            u16 hl = hl_u8(cpu->h, cpu->l);
-            ++hl;
-            cpu->h = hl >> 8;
-            cpu->l = hl & 0xff;
-        } break;
-        case 0x33: { // INX SP
-            ++cpu->sp;
-        } break;
-
-        case 0x0b:  { // DCX B 
-            u16 bc = ((u16)cpu->b << 8) | (u16)cpu->c;
-            --bc;
-            cpu->b = bc >> 8;
-            cpu->c = bc & 0xff;
-        } break;
-        case 0x1b:  { // DCX D
-            u16 de = ((u16)cpu->d << 8) | (u16)cpu->e;
-            --de;
-            cpu->d = de >> 8;
-            cpu->e = de & 0xff;
-        } break;
-        case 0x2b:  { // DCX H
-            u16 hl = ((u16)cpu->h << 8) | (u16)cpu->l;
-            --hl;
-            cpu->h = hl >> 8;
-            cpu->l = hl & 0xff;
-        } break;
-        case 0x3b:  { // DCX SP 
-            --cpu->sp;
-        } break;
-
-        case 0x09: /* DAD B */ dad(cpu, cpu->b, cpu->c);  break;
-        case 0x19: /* DAD D */ dad(cpu, cpu->d, cpu->e);  break;
-        case 0x29: /* DAD H */ dad(cpu, cpu->h, cpu->l);  break;
-
-        case 0x39: { // DAD SP 
-            u16 hl = ((u16)cpu->h << 8) | (u16)cpu->l;
-            u32 result = hl + cpu->sp;
-            cpu->cc.cy = (result > 0xffff);
-            cpu->h = (result & 0xffff) >> 8;
-            cpu->l = result & 0xff;
-        } break;
-        
-        //MVI 
-        case 0x06: cpu->b = oc[1]; cpu->pc++; break;
-        case 0x0e: cpu->c = oc[1]; cpu->pc++; break;
-        case 0x16: cpu->d = oc[1]; cpu->pc++; break;
-        case 0x1e: cpu->e = oc[1]; cpu->pc++; break;
-        case 0x26: cpu->h = oc[1]; cpu->pc++; break;
-        case 0x2e: cpu->l = oc[1]; cpu->pc++; break;
-        case 0x36: cpu->m[mem_offset(cpu)] = oc[1]; cpu->pc++; break;
-        case 0x3e: cpu->a = oc[1]; cpu->pc++; break;
-
-        // INR 
-        case 0x04: cpu->b = increment(cpu, cpu->b); break;
-        case 0x0c: cpu->c = increment(cpu, cpu->c); break;
-        case 0x14: cpu->d = increment(cpu, cpu->d); break;
-        case 0x1c: cpu->e = increment(cpu, cpu->e); break;
-        case 0x24: cpu->h = increment(cpu, cpu->h); break;
-        case 0x2c: cpu->l = increment(cpu, cpu->l); break;
-        case 0x34: cpu->m[mem_offset(cpu)] = increment(cpu, cpu->m[mem_offset(cpu)]); break;
-        case 0x3c: cpu->a = increment(cpu, cpu->a); break;
-
-        // DCR
-        case 0x05: cpu->b = decrement(cpu, cpu->b); break;
-        case 0x0d: cpu->c = decrement(cpu, cpu->c); break;
-        case 0x15: cpu->d = decrement(cpu, cpu->d); break;
-        case 0x1d: cpu->e = decrement(cpu, cpu->e); break;
-        case 0x25: cpu->h = decrement(cpu, cpu->h); break;
-        case 0x2d: cpu->l = decrement(cpu, cpu->l); break;
-        case 0x35: cpu->m[mem_offset(cpu)] = decrement(cpu, cpu->m[mem_offset(cpu)]); break;
-        case 0x3d: cpu->a = decrement(cpu, cpu->a); break;
-
-        //MOV B,R
-        case 0x40 ... 0x45: cpu->b = cpu->r[*oc-0x40+1]; break;
-        case 0x46: cpu->b = cpu->m[mem_offset(cpu)]; break; 
-        case 0x47: cpu->b = cpu->a; break;
-
-        //MOV C,R
-        case 0x48 ... 0x4d: cpu->c = cpu->r[*oc-0x48+1]; break;
-        case 0x4e: cpu->c = cpu->m[mem_offset(cpu)]; break; 
-        case 0x4f: cpu->c = cpu->a; break;
-
-        //MOV D,R
-        case 0x50 ... 0x55: cpu->d = cpu->r[*oc-0x50+1]; break;
-        case 0x56: cpu->d = cpu->m[mem_offset(cpu)]; break; 
-        case 0x57: cpu->d = cpu->a; break;
-
-        //MOV E,R
-        case 0x58 ... 0x5d: cpu->e = cpu->r[*oc-0x58+1]; break;
-        case 0x5e: cpu->e = cpu->m[mem_offset(cpu)]; break; 
-        case 0x5f: cpu->e = cpu->a; break;
-
-        //MOV H,R
-        case 0x60 ... 0x65: cpu->h = cpu->r[*oc-0x60+1]; break;
-        case 0x66: cpu->h = cpu->m[mem_offset(cpu)]; break; 
-        case 0x67: cpu->h = cpu->a; break;
-
-        //MOV L,R
-        case 0x68 ... 0x6d: cpu->l = cpu->r[*oc-0x68+1]; break;
-        case 0x6e: cpu->l = cpu->m[mem_offset(cpu)]; break; 
-        case 0x6f: cpu->l = cpu->a; break;
-
-        //MOV M,R
-        case 0x70 ... 0x75: cpu->m[mem_offset(cpu)] = cpu->r[*oc-0x70+1]; break;
-        case 0x77: cpu->m[mem_offset(cpu)] = cpu->a; break;
-
-        //MOV A,R
-        case 0x78 ... 0x7d: cpu->a = cpu->r[*oc-0x78+1]; break;
-        case 0x7e: cpu->a = cpu->m[mem_offset(cpu)]; break; 
-        case 0x7f: cpu->a = cpu->a; break;
-
-        //ADD
-        case 0x80 ... 0x85: cpu->a = add(cpu, cpu->a, cpu->r[*oc-0x80+1]); break;
-        case 0x86: cpu->a = add(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0x87: cpu->a = add(cpu, cpu->a, cpu->a); break; 
-
-        //ADC
-        case 0x88 ... 0x8d: cpu->a = carry_add(cpu, cpu->a, cpu->r[*oc-0x88+1]); break;
-        case 0x8e: cpu->a = carry_add(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break;
-        case 0x8f: cpu->a = carry_add(cpu, cpu->a, cpu->a); break;
-
-        //SUB
-        case 0x90 ... 0x95: cpu->a = sub(cpu, cpu->a, cpu->r[*oc-0x90+1]); break;
-        case 0x96: cpu->a = sub(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0x97: cpu->a = sub(cpu, cpu->a, cpu->a); break; 
-
-        //SBB
-        case 0x98 ... 0x9d: cpu->a = carry_sub(cpu, cpu->a, cpu->r[*oc-0x98+1]); break;
-        case 0x9e: cpu->a = carry_sub(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0x9f: cpu->a = carry_sub(cpu, cpu->a, cpu->a); break; 
-
-        //ANA 
-        case 0xa0 ... 0xa5: cpu->a = bitwise_and(cpu, cpu->a, cpu->r[*oc-0xa0+1]); break;
-        case 0xa6: cpu->a = bitwise_and(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0xa7: cpu->a = bitwise_and(cpu, cpu->a, cpu->a); break; 
-
-        //XRA 
-        case 0xa8 ... 0xad: cpu->a = bitwise_xor(cpu, cpu->a, cpu->r[*oc-0xa8+1]); break;
-        case 0xae: cpu->a = bitwise_xor(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0xaf: cpu->a = bitwise_xor(cpu, cpu->a, cpu->a); break; 
-
-        //CMP
-        case 0xb8 ... 0xbd: cmp(cpu, cpu->a, cpu->r[*oc-0xb8+1]); break;
-        case 0xbe: cmp(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0xbf: cmp(cpu, cpu->a, cpu->a); break; 
-
-        //ORA 
-        case 0xb0 ... 0xb5: cpu->a = bitwise_or(cpu, cpu->a, cpu->r[*oc-0xb0+1]); break;
-        case 0xb6: cpu->a = bitwise_or(cpu, cpu->a, cpu->m[mem_offset(cpu)]); break; 
-        case 0xb7: cpu->a = bitwise_or(cpu, cpu->a, cpu->a); break; 
-
-        case 0xc6: /* ADI */ cpu->a = add(cpu, cpu->a, oc[1]);         cpu->pc++; break; 
-        case 0xce: /* ACI */ cpu->a = carry_add(cpu, cpu->a, oc[1]);   cpu->pc++; break; 
-        case 0xd6: /* SUI */ cpu->a = sub(cpu, cpu->a, oc[1]);         cpu->pc++; break; 
-        case 0xde: /* SBI */ cpu->a = carry_sub(cpu, cpu->a, oc[1]);   cpu->pc++; break; 
-        case 0xe6: /* ANI */ cpu->a = bitwise_and(cpu, cpu->a, oc[1]); cpu->pc++; break;
-        case 0xee: /* XRI */ cpu->a = bitwise_xor(cpu, cpu->a, oc[1]); cpu->pc++; break;
-        case 0xf6: /* ORI */ cpu->a = bitwise_or(cpu, cpu->a, oc[1]);  cpu->pc++; break;
-        case 0xfe: /* CPI */ cmp(cpu, cpu->a, oc[1]);                    cpu->pc++; break;
-
-        case 0xc1: /* POP B */  stack_pop_u8_hl(cpu, &cpu->b, &cpu->c); break;
-        case 0xd1: /* POP D */  stack_pop_u8_hl(cpu, &cpu->d, &cpu->e); break;
-        case 0xe1: /* POP H */  stack_pop_u8_hl(cpu, &cpu->h, &cpu->l); break;
-
-        case 0xc5: /* PUSH B */ stack_push_u8_hl(cpu, cpu->b, cpu->c); break;
-        case 0xd5: /* PUSH D */ stack_push_u8_hl(cpu, cpu->d, cpu->e); break;
-        case 0xe5: /* PUSH H */ stack_push_u8_hl(cpu, cpu->h, cpu->l); break;
-
-        case 0xf1: { // POP PSW
-            u8 flags = cpu->m[cpu->sp + 0];
-            cpu->cc.cy = (flags >> 0) & 1;
-            cpu->cc.p  = (flags >> 2) & 1;
-            cpu->cc.ac = (flags >> 4) & 1;
-            cpu->cc.z  = (flags >> 6) & 1;
-            cpu->cc.s  = (flags >> 7) & 1;
-            cpu->a  = cpu->m[cpu->sp + 1];
-            cpu->sp += 2;
-        } break;
-
-        case 0xf5: { // PUSH PSW
-            u8 flags = cpu->cc.cy;
-            flags |= 1 << 1;
-            flags |= cpu->cc.p  << 2;
-            flags |= cpu->cc.ac << 4;
-            flags |= cpu->cc.z  << 6;
-            flags |= cpu->cc.s  << 7;
-            cpu->m[cpu->sp - 2] = flags;
-            cpu->m[cpu->sp - 1] = cpu->a;
-            cpu->sp -= 2;
-        } break;
-
-        case 0xe3: { //XHTL
-            si_swap(cpu->l, cpu->m[cpu->sp + 0], u8);
-            si_swap(cpu->h, cpu->m[cpu->sp + 1], u8);
-        } break;
-        case 0xeb: { //XCHG
-            si_swap(cpu->h, cpu->d, u8);
-            si_swap(cpu->l, cpu->e, u8);
-        } break;
- 
-        case 0xc9: /* RET */ ret(cpu); break; 
-        case 0xc0: /* RNZ */ if(cpu->cc.z  == 0) ret(cpu); break; 
-        case 0xc8: /* RZ  */ if(cpu->cc.z  == 1) ret(cpu); break; 
-        case 0xd0: /* RNC */ if(cpu->cc.cy == 0) ret(cpu); break; 
-        case 0xd8: /* RC  */ if(cpu->cc.cy == 1) ret(cpu); break;
-        case 0xe0: /* RPO */ if(cpu->cc.p  == 0) ret(cpu); break;
-        case 0xe8: /* RPE */ if(cpu->cc.p  == 1) ret(cpu); break;
-        case 0xf0: /* RP  */ if(cpu->cc.s  == 0) ret(cpu); break; 
-        case 0xf8: /* RM  */ if(cpu->cc.s  == 1) ret(cpu); break;
-            
-        case 0xcd: /* CALL */ { 
-#if CPUDIAG //NOTE: this is specific to the cpu-diag program
-            if(((oc[2] << 8) | oc[1]) == 5) {
-                if(cpu->c == 9) {
-                    uint16_t offset = (cpu->d << 8) | (cpu->e);    
-                    u8 *str = &cpu->m[offset+3];  //skip the prefix bytes    
-                    while (*str != '$') {
-                        printf("%c", *str++);    
-                    }
-                    printf("\n");    
-                    return 0;
-                } else if (cpu->c == 2) {    
-                    printf ("print char routine called\n");    
-                }  
-            } else if (((oc[2] << 8) | oc[1]) == 0) {
-                return 0;
-            } else {
-                call_hl(cpu, oc[1], oc[2]); break;
-            }    
-#else
-            call_hl(cpu, oc[1], oc[2]); 
-#endif
-        } break;
-
-        case 0xc4: /* CNZ  */ if(cpu->cc.z  == 0) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xcc: /* CZ   */ if(cpu->cc.z  == 1) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xd4: /* CNC  */ if(cpu->cc.cy == 0) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xdc: /* CC   */ if(cpu->cc.cy == 1) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xe4: /* CPO  */ if(cpu->cc.p  == 0) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xec: /* CPE  */ if(cpu->cc.p  == 1) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xf4: /* CP   */ if(cpu->cc.s  == 0) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xfc: /* CM   */ if(cpu->cc.s  == 1) call_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-
-        case 0xc3: /* JMP */ jmp_hl(cpu, oc[1], oc[2]); break;
-        case 0xc2: /* JNZ */ if(cpu->cc.z  == 0) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xca: /* JZ  */ if(cpu->cc.z  == 1) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xd2: /* JNC */ if(cpu->cc.cy == 0) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xda: /* JC  */ if(cpu->cc.cy == 1) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xe2: /* JPO */ if(cpu->cc.p  == 0) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xea: /* JPE */ if(cpu->cc.p  == 1) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xf2: /* JP  */ if(cpu->cc.s  == 0) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-        case 0xfa: /* JM  */ if(cpu->cc.s  == 1) jmp_hl(cpu, oc[1], oc[2]); else cpu->pc += 2; break;
-
-        case 0xf9: /* SPHL */ cpu->sp = (cpu->h << 8) | cpu->l; break; 
-        case 0xe9: /* PCHL */ cpu->pc = (cpu->h << 8) | cpu->l; cpu->pc--; break;
-
-        case 0xc7: /* RST 0 */ call(cpu,  0); break;
-        case 0xcf: /* RST 1 */ call(cpu,  8); break;
-        case 0xd7: /* RST 2 */ call(cpu, 10); break;
-        case 0xdf: /* RST 3 */ call(cpu, 18); break;
-        case 0xe7: /* RST 4 */ call(cpu, 20); break;
-        case 0xef: /* RST 5 */ call(cpu, 28); break;
-        case 0xf7: /* RST 6 */ call(cpu, 30); break;
-        case 0xff: /* RST 7 */ call(cpu, 38); break;
-
-        case 0x27: /* DAA */ break; // Special
-//        case 0xd3: /* OUT */ break; // Special
-//       case 0xdb: /* IN  */ break; // Special
-
-        case 0xf3: /* DI  */ cpu->interruptEnabled = 0; break;
-        case 0xfb: /* EI  */ cpu->interruptEnabled = 1; break;
-
-        case 0x76: return 0; //HLT(special)
-
-        default: {
-            unimplemented_instruction(cpu, oc[0]);
-            //printf("Unimplemented: 0x%02x\n", *oc);
-        } break;
+    if (cpu->traps || cpu->log || cpu->hash || cpu->trace || cpu->countCycles) return step_attached(cpu);
+    return step_flat(cpu);
+}
+
+int
+emulate_8080_flat(struct cpu_8080 *cpu)
+{
+    return step_flat(cpu);
+}
+
+void
+traps_set(traps_8080 *traps, u16 addr, u8 access)
+{
+    traps->addrs[addr] |= access;
+    traps->pages[addr >> 8] |= access;
+    traps->all |= access;
+}
+
+void
+traps_clear(traps_8080 *traps, u16 addr, u8 access)
+{
+    traps->addrs[addr] &= ~access;
+
+    u8 page = 0;
+    u8 *addrs = &traps->addrs[addr & 0xff00];
+    for (int i = 0; i < 0x100; ++i) {
+        page |= addrs[i];
     }
-    cpu->pc += 1;
+    traps->pages[addr >> 8] = page;
 
-    return 1;
-    // clang-format on
+    traps->all = 0;
+    for (int i = 0; i < 0x100; ++i) {
+        traps->all |= traps->pages[i];
+    }
+}
+
+void
+state_hash_attach(struct cpu_8080 *cpu, state_hash_8080 *hash, size_t memSize)
+{
+    hash->memSize = memSize;
+    cpu->hash = hash;
+    state_hash_reset(cpu);
+}
+
+void
+state_hash_reset(struct cpu_8080 *cpu)
+{
+    state_hash_8080 *hash = cpu->hash;
+    hash->mem = 0;
+    for (size_t page = 0; page < 0x100; ++page) {
+        u64 h = 0;
+        size_t start = page << 8;
+        size_t end = start + 0x100 < hash->memSize ? start + 0x100 : hash->memSize;
+        for (size_t addr = start; addr < end; ++addr) {
+            h ^= hash_byte(addr, cpu->m[addr]);
+        }
+        hash->pages[page] = h;
+        hash->mem ^= h;
+    }
+}
+
+u64
+state_fingerprint(struct cpu_8080 *cpu)
+{
+    u64 regs = 0;
+    for (int i = 0; i < 7; ++i) {
+        regs = (regs << 8) | cpu->r[i];
+    }
+    u8 flags = cpu->cc.s << 7 | cpu->cc.z << 6 | cpu->cc.ac << 4 | cpu->cc.p << 2 | cpu->cc.cy;
+    regs = (regs << 8) | flags;
+    u64 pointers = (u64)cpu->sp << 32 | (u64)cpu->pc << 16 | cpu->halted << 1 | cpu->interruptEnabled;
+    return hash_mix(hash_mix(regs) ^ pointers) ^ cpu->hash->mem;
+}
+
+run_result
+run_8080(struct cpu_8080 *cpu, u64 maxSteps)
+{
+    run_result result = {0};
+    u64 end = maxSteps > UINT64_MAX - cpu->steps ? UINT64_MAX : cpu->steps + maxSteps;
+
+    // Only the breakpoint the previous call stopped at is stepped over.
+    int resume = cpu->resumeBreak && cpu->resumePc == cpu->pc;
+    cpu->resumeBreak = 0;
+    if (cpu->trapHit) return watch_stop(cpu);
+
+    // Without traps there is nothing to check between instructions.
+    if (!cpu->traps) {
+        int running;
+        if (cpu->log || cpu->hash || cpu->trace) running = run_hooked(cpu, end);
+        else if (cpu->countCycles) running = run_timed(cpu, end);
+        else running = run_flat(cpu, end);
+        result.reason = running ? STOP_STEP_LIMIT : STOP_HALT;
+        return result;
+    }
+
+    // Only traps attached is the common debugger case. Breakpoints are checked
+    // between instructions, so without watchpoints the plain engines do.
+    if (cpu->log || cpu->hash || cpu->trace) return step_hooked_run_traps(cpu, end, resume);
+    if (cpu->traps->all & (TRAP_READ | TRAP_WRITE)) {
+        if (cpu->countCycles) return step_hooked_run_traps(cpu, end, resume);
+        return step_trapped_run_traps(cpu, end, resume);
+    }
+    if (cpu->countCycles) return step_timed_run_traps(cpu, end, resume);
+    return step_flat_run_traps(cpu, end, resume);
 }
@@ -26,6 +26,8 @@ SOFTWARE.
 #define C8080_INCLUDE_GUARD
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #define internal static
 #define local_persist static
@@ -49,6 +51,87 @@ typedef struct condition_codes {
     u8 pad : 3;
 } condition_codes;
 
+struct cpu_8080;
+
+typedef u8 (*port_in_fn)(struct cpu_8080 *cpu, u8 port);
+typedef void (*port_out_fn)(struct cpu_8080 *cpu, u8 port, u8 val);
+typedef int (*trace_fn)(struct cpu_8080 *cpu);
+
+typedef enum io_log_mode {
+    IO_LOG_OFF = 0,
+    IO_LOG_RECORD,
+    IO_LOG_REPLAY,
+} io_log_mode;
+
+typedef enum io_event_kind {
+    IO_EVENT_IN = 0,
+    IO_EVENT_INTERRUPT,
+} io_event_kind;
+
+typedef struct io_event {
+    u64 step;   // value of cpu->steps when the input was consumed
+    u8 kind;    // io_event_kind
+    u8 port;    // port for IN, interrupt number for INTERRUPT
+    u8 value;   // value read for IN, unused otherwise
+} io_event;
+
+// Log of every non-deterministic input the cpu sees. While recording, events are
+// kept in memory and appended to `file` (if any) as they happen. While replaying,
+// IN reads and interrupts come from the log and the port callbacks are never called.
+typedef struct io_log {
+    io_log_mode mode;
+    io_event *events;
+    size_t count;
+    size_t capacity;
+    size_t cursor;  // next event to replay
+    u64 fileStep;   // step of the last event written to file (delta encoding)
+    FILE *file;
+    u64 resumeStep; // once replay drained the log and reached this step, go back to recording
+    u8 desync;      // set when the guest asked for an input the log doesn't have
+    u8 truncated;   // replay: the file ended inside a record, the complete ones before it are kept
+    u32 unflushed;  // records written since the file was last flushed
+} io_log;
+
+typedef enum trap_access {
+    TRAP_EXEC = 1 << 0,
+    TRAP_READ = 1 << 1,
+    TRAP_WRITE = 1 << 2,
+} trap_access;
+
+// Breakpoints and watchpoints. pages[] has the bits of every address in the 256 byte
+// page or'd together, and all those of every page. Only change it through traps_set
+// and traps_clear.
+typedef struct traps_8080 {
+    u8 pages[0x100];
+    u8 all;
+    u8 addrs[0x10000];
+} traps_8080;
+
+// Memory hash kept up to date by the stores the cpu makes. Every byte contributes a
+// hash of its address and value, xor'd together per 256 byte page (pages[]) and for
+// all of memory (mem), so a store only has to swap out one term. Attach it with
+// state_hash_attach, and call state_hash_reset after changing memory behind the
+// cpu's back (host pokes, loading a snapshot).
+typedef struct state_hash_8080 {
+    u64 pages[0x100];
+    u64 mem;
+    size_t memSize;
+} state_hash_8080;
+
+typedef enum stop_reason {
+    STOP_STEP_LIMIT = 0,
+    STOP_HALT,          // emulate_8080 returned 0 (HLT, replay desync or trace)
+    STOP_BREAKPOINT,    // about to execute addr
+    STOP_WATCH_READ,    // the last instruction read addr
+    STOP_WATCH_WRITE,   // the last instruction wrote addr
+} stop_reason;
+
+typedef struct run_result {
+    stop_reason reason;
+    u16 addr;
+    u8 access;          // trap_access that triggered the stop
+} run_result;
+
 typedef struct cpu_8080 {
     union {
         struct {
@@ -62,9 +145,77 @@ typedef struct cpu_8080 {
     u8 *m;
     condition_codes cc;
     u8 interruptEnabled;
+    u8 halted;       // set by HLT, which leaves pc on itself. The next interrupt clears it
+                     // and returns to the instruction after the HLT
+
+    port_in_fn in;   // optional, IN reads 0 without it
+    port_out_fn out; // optional
+    trace_fn trace;  // optional, called before every instruction. Return 0 to stop
+                     // before it runs, emulate_8080 then returns 0
+    void *userData;
+    io_log *log;     // optional record/replay log
+    u64 steps;       // number of instructions executed
+    u64 cycles;      // clock cycles those took, see countCycles
+    u8 countCycles;  // count cycles with nothing attached too. They are always counted
+                     // while log, hash or trace are set, never by emulate_8080_flat
+
+    traps_8080 *traps;  // optional breakpoints and watchpoints
+    u8 trapHit;         // set by the first watched access until run_8080 reports it
+    u8 trapAccess;
+    u16 trapAddr;
+    u8 resumeBreak;     // run_8080 stopped at the breakpoint at resumePc
+    u16 resumePc;
+
+    state_hash_8080 *hash; // optional, see state_hash_attach
 } cpu_8080;
 
 //Returns 0 when exit is called. Returns 1 otherwise
 int emulate_8080(struct cpu_8080 *cpu);
 
+//Same as emulate_8080 but ignores traps, log, hash, trace and cycles. emulate_8080 runs it
+//too while none of them is attached and countCycles is 0.
+int emulate_8080_flat(struct cpu_8080 *cpu);
+
+//Runs up to maxSteps instructions, stopping early at a breakpoint, a watched access
+//or when emulate_8080 returns 0. Resuming from the breakpoint it stopped at executes
+//it. A watched access made outside of it (e.g. by interrupt_8080) is reported first.
+run_result run_8080(struct cpu_8080 *cpu, u64 maxSteps);
+
+//Adds/removes trap_access bits for addr.
+void traps_set(traps_8080 *traps, u16 addr, u8 access);
+void traps_clear(traps_8080 *traps, u16 addr, u8 access);
+
+//Hashes the first memSize bytes of cpu->m into hash and attaches it to cpu. Stores
+//past memSize are left out of the hash.
+//Set cpu->hash to NULL to detach it.
+void state_hash_attach(struct cpu_8080 *cpu, state_hash_8080 *hash, size_t memSize);
+
+//Rehashes all of memory. Needed after anything but the cpu changed it.
+void state_hash_reset(struct cpu_8080 *cpu);
+
+//64-bit fingerprint of registers, flags, interrupt enable, halted and memory in O(1).
+//Equal states give equal fingerprints; steps, cycles and callbacks are left out.
+//Requires an attached hash.
+u64 state_fingerprint(struct cpu_8080 *cpu);
+
+//Requests RST interruptNum. Returns 1 if the interrupt was taken, 0 if interrupts
+//are disabled or the cpu is replaying a log (interrupts then come from the log).
+int interrupt_8080(struct cpu_8080 *cpu, int interruptNum);
+
+//Starts recording inputs into log. path may be NULL to only keep them in memory.
+//Returns 1 on success.
+int io_log_record(struct cpu_8080 *cpu, io_log *log, const char *path);
+
+//Loads a log written by io_log_record and replays it on cpu. Returns 1 on success.
+//A log cut off in the middle of a record (the recording process died) still loads,
+//with every complete record and log->truncated set.
+int io_log_replay(struct cpu_8080 *cpu, io_log *log, const char *path);
+
+//Forgets the first n events in memory, the file keeps them. Cursors into events
+//move down by n. For hosts that only need recent history.
+void io_log_discard(io_log *log, size_t n);
+
+//Flushes and closes the log file and frees the events. Detaches it from cpu.
+void io_log_close(struct cpu_8080 *cpu, io_log *log);
+
 #endif //C8080_INCLUDE_GUARD
@@ -0,0 +1,649 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Instruction semantics of the 8080, written once and compiled into one engine per
+// policy combination. Define these and include this file, it cleans up after itself:
+//
+//   CORE_STEP    name of the generated `internal inline int CORE_STEP(cpu)`
+//   CORE_RUN     optional, name of a generated loop `internal int CORE_RUN(cpu, end)`
+//                that steps until cpu->steps == end. Returns 0 if a step returned 0
+//   CORE_TRAPS   1: data loads/stores check cpu->traps for watchpoints
+//   CORE_HASH    1: stores update cpu->hash
+//   CORE_IO_LOG  1: IN and interrupts go through cpu->log (record/replay)
+//                0: IN/OUT call cpu->in/cpu->out directly
+//   CORE_CYCLES  1: count cpu->cycles
+//   CORE_TRACE   1: call cpu->trace before every instruction
+//
+// Every engine also gets CORE_FN(run_traps), the run_8080 loop with traps attached.
+// Helpers that don't touch memory or devices live in c8080.c and are shared.
+
+#define CORE_FN_(prefix, name) prefix##_##name
+#define CORE_FN_EXPAND(prefix, name) CORE_FN_(prefix, name)
+#define CORE_FN(name) CORE_FN_EXPAND(CORE_STEP, name)
+
+// Operands wrap around to the start of memory past 0xffff.
+#define CORE_OPERAND(cpu, i) ((cpu)->m[(u16)((cpu)->pc + (i))])
+
+#if CORE_TRAPS || CORE_HASH
+#define CORE_READ(cpu, addr) CORE_FN(read)(cpu, addr)
+#define CORE_WRITE(cpu, addr, val) CORE_FN(write)(cpu, addr, val)
+#else
+#define CORE_READ(cpu, addr) ((cpu)->m[(u16)(addr)])
+#define CORE_WRITE(cpu, addr, val) ((cpu)->m[(u16)(addr)] = (val))
+#endif
+
+#if CORE_IO_LOG
+#define CORE_IN(cpu, port) port_in(cpu, port)
+#define CORE_OUT(cpu, port, val) port_out(cpu, port, val)
+#else
+#define CORE_IN(cpu, port) ((cpu)->in ? (cpu)->in(cpu, port) : 0)
+#define CORE_OUT(cpu, port, val) do { if ((cpu)->out) (cpu)->out(cpu, port, val); } while (0)
+#endif
+
+#if CORE_CYCLES
+#define CORE_ADD_CYCLES(cpu, n) ((cpu)->cycles += (n))
+#else
+#define CORE_ADD_CYCLES(cpu, n) ((void)0)
+#endif
+
+#if CORE_TRAPS || CORE_HASH
+// Every data load and store goes through these.
+internal inline u8
+CORE_FN(read)(struct cpu_8080 *cpu, u16 addr)
+{
+#if CORE_TRAPS
+    if (cpu->traps && (cpu->traps->pages[addr >> 8] & TRAP_READ)) trap_hit(cpu, addr, TRAP_READ);
+#endif
+    return cpu->m[addr];
+}
+
+internal inline void
+CORE_FN(write)(struct cpu_8080 *cpu, u16 addr, u8 val)
+{
+#if CORE_TRAPS
+    if (cpu->traps && (cpu->traps->pages[addr >> 8] & TRAP_WRITE)) trap_hit(cpu, addr, TRAP_WRITE);
+#endif
+#if CORE_HASH
+    if (cpu->hash) hash_store(cpu, addr, val);
+#endif
+    cpu->m[addr] = val;
+}
+#endif
+
+internal inline void
+CORE_FN(ret)(struct cpu_8080 *cpu)
+{
+    // -1 because the pc is incremented once the instruction is done
+    cpu->pc = ((CORE_READ(cpu, cpu->sp + 1) << 8) | (CORE_READ(cpu, cpu->sp + 0))) - 1;
+    cpu->sp += 2;
+}
+internal inline void
+CORE_FN(call)(struct cpu_8080 *cpu, u16 addr)
+{
+    u16 ret = cpu->pc + 3;
+    CORE_WRITE(cpu, cpu->sp - 1, (ret >> 8) & 0xff);
+    CORE_WRITE(cpu, cpu->sp - 2, (ret & 0xff));
+    cpu->pc = addr - 1;
+    cpu->sp -= 2;
+}
+
+internal inline void
+CORE_FN(rst)(struct cpu_8080 *cpu, u16 addr)
+{
+    u16 ret = cpu->pc + 1;
+    CORE_WRITE(cpu, cpu->sp - 1, (ret >> 8) & 0xff);
+    CORE_WRITE(cpu, cpu->sp - 2, (ret & 0xff));
+    cpu->pc = addr - 1;
+    cpu->sp -= 2;
+}
+
+internal inline void
+CORE_FN(ret_if)(struct cpu_8080 *cpu, int cond)
+{
+    if (cond) {
+        CORE_FN(ret)(cpu);
+        CORE_ADD_CYCLES(cpu, 6);
+    }
+}
+
+internal inline void
+CORE_FN(call_if)(struct cpu_8080 *cpu, int cond, u8 addrLow, u8 addrHigh)
+{
+    if (cond) {
+        CORE_FN(call)(cpu, hl_u8(addrHigh, addrLow));
+        CORE_ADD_CYCLES(cpu, 6);
+    } else {
+        cpu->pc += 2;
+    }
+}
+
+internal inline void
+CORE_FN(stack_push_u8_hl)(struct cpu_8080 *cpu, u8 high, u8 low)
+{
+    CORE_WRITE(cpu, cpu->sp - 1, high);
+    CORE_WRITE(cpu, cpu->sp - 2, low);
+    cpu->sp -= 2;
+}
+
+internal inline void
+CORE_FN(stack_pop_u8_hl)(struct cpu_8080 *cpu, u8 *regH, u8 *regL)
+{
+    *regL = CORE_READ(cpu, cpu->sp + 0);
+    *regH = CORE_READ(cpu, cpu->sp + 1);
+    cpu->sp += 2;
+}
+
+internal inline int //Returns 0 when exit is called. Returns 1 otherwise
+CORE_STEP(struct cpu_8080 *cpu)
+{
+#if CORE_IO_LOG
+    if (cpu->log && cpu->log->mode == IO_LOG_REPLAY) replay_interrupts(cpu);
+#endif
+#if CORE_TRACE
+    if (cpu->trace && !cpu->trace(cpu)) return 0;
+#endif
+
+    u8 op = cpu->m[cpu->pc];
+    CORE_ADD_CYCLES(cpu, cycles_8080[op]);
+
+    // clang-format off
+    switch (op) {
+
+        case 0x00: break; // NOP
+        case 0x08: break; // NOP
+        case 0x10: break; // NOP
+        case 0x18: break; // NOP
+        case 0x20: break; // NOP
+        case 0x28: break; // NOP
+        case 0x30: break; // NOP
+        case 0x38: break; // NOP
+
+        case 0x02: { //STAX B
+            CORE_WRITE(cpu, hl_u8(cpu->b, cpu->c), cpu->a);
+        } break;
+        case 0x12: { //STAX D
+            CORE_WRITE(cpu, hl_u8(cpu->d, cpu->e), cpu->a);
+        } break;
+        case 0x32: { //STA addr 
+            CORE_WRITE(cpu, hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1)), cpu->a);
+            cpu->pc += 2;
+        } break;
+
+        case 0x0a: { //LDAX B
+            u16 addr = hl_u8(cpu->b, cpu->c);
+            cpu->a = CORE_READ(cpu, addr);
+        } break;
+        case 0x1a: { //LDAX D
+            u16 addr = hl_u8(cpu->d, cpu->e);
+            cpu->a = CORE_READ(cpu, addr);
+        } break;
+        case 0x3a: { //LDA addr 
+            u16 addr = hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1));
+            cpu->a = CORE_READ(cpu, addr);
+            cpu->pc += 2;
+        } break;
+
+        case 0x22: { //SHLD addr
+            u16 addr = hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1));
+            CORE_WRITE(cpu, addr+0, cpu->l);
+            CORE_WRITE(cpu, addr+1, cpu->h);
+            cpu->pc += 2;
+        } break;
+
+        case 0x2a: { //LHLD addr
+            u16 addr = hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1));
+            cpu->l = CORE_READ(cpu, addr+0);
+            cpu->h = CORE_READ(cpu, addr+1);
+            cpu->pc += 2;
+        } break;
+
+        case 0x07: {  //RLC (A = A << 1; bit 0 = prev bit 7; CY = prev bit 7)
+            u8 result = cpu->a << 1;
+            u8 bit7 = cpu->a >> 7;
+            cpu->cc.cy = bit7;
+            cpu->a = result | bit7; 
+        } break;
+
+        case 0x0f: { //RRC (A = A >> 1; bit 7 = prev bit 0; CY = prev bit 0)
+            //shift
+            u8 result = cpu->a >> 1;
+            u8 bit0 = (cpu->a & 0x01);
+            cpu->cc.cy = bit0;
+            cpu->a = result | (bit0 << 7);
+        } break;
+
+        case 0x17: { //RAL (A = A << 1; bit0 = prev CY; CY = prev bit 7)
+            u8 result = (cpu->a << 1) | cpu->cc.cy;
+            cpu->cc.cy = cpu->a >> 7;
+            cpu->a = result;
+        } break;
+
+        case 0x1f: { //RAR (A = A >> 1; bit 7 = prev CY; CY = prev bit 0)
+            u8 result = (cpu->a >> 1) | (cpu->cc.cy << 7);
+            cpu->cc.cy = cpu->a & 0x01; 
+            cpu->a = result;
+        } break;
+
+        case 0x2f: /* CMA */ cpu->a = ~cpu->a; break; 
+        case 0x3f: /* CMC */ cpu->cc.cy = !cpu->cc.cy; break;
+        case 0x37: /* STC */ cpu->cc.cy = 1; break;
+
+        case 0x01: { // LXI B,word
+            cpu->c = CORE_OPERAND(cpu, 1);
+            cpu->b = CORE_OPERAND(cpu, 2);
+            cpu->pc += 2;
+        } break;
+        case 0x11: { // LXI D,word
+            cpu->e = CORE_OPERAND(cpu, 1);
+            cpu->d = CORE_OPERAND(cpu, 2);
+            cpu->pc += 2;
+        } break;
+        case 0x21: { // LXI H,word
+            cpu->l = CORE_OPERAND(cpu, 1);
+            cpu->h = CORE_OPERAND(cpu, 2);
+            cpu->pc += 2;
+        } break;
+        case 0x31: { // LXI SP,word
+            cpu->sp = hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1));
+            cpu->pc += 2;
+        } break;
+
+        case 0x03: { // INX B
+            u16 bc = hl_u8(cpu->b, cpu->c);
+            ++bc;
+            cpu->b = bc >> 8;
+            cpu->c = bc & 0xff;
+        } break;
+        case 0x13: { // INX D
+            u16 de = hl_u8(cpu->d, cpu->e);
+            ++de;
+            cpu->d = de >> 8;
+            cpu->e = de & 0xff;
+        } break;
+        case 0x23: { // INX H
+            u16 hl = hl_u8(cpu->h, cpu->l);
+            ++hl;
+            cpu->h = hl >> 8;
+            cpu->l = hl & 0xff;
+        } break;
+        case 0x33: { // INX SP
+            ++cpu->sp;
+        } break;
+
+        case 0x0b:  { // DCX B 
+            u16 bc = ((u16)cpu->b << 8) | (u16)cpu->c;
+            --bc;
+            cpu->b = bc >> 8;
+            cpu->c = bc & 0xff;
+        } break;
+        case 0x1b:  { // DCX D
+            u16 de = ((u16)cpu->d << 8) | (u16)cpu->e;
+            --de;
+            cpu->d = de >> 8;
+            cpu->e = de & 0xff;
+        } break;
+        case 0x2b:  { // DCX H
+            u16 hl = ((u16)cpu->h << 8) | (u16)cpu->l;
+            --hl;
+            cpu->h = hl >> 8;
+            cpu->l = hl & 0xff;
+        } break;
+        case 0x3b:  { // DCX SP 
+            --cpu->sp;
+        } break;
+
+        case 0x09: /* DAD B */ dad(cpu, cpu->b, cpu->c);  break;
+        case 0x19: /* DAD D */ dad(cpu, cpu->d, cpu->e);  break;
+        case 0x29: /* DAD H */ dad(cpu, cpu->h, cpu->l);  break;
+
+        case 0x39: { // DAD SP 
+            u16 hl = ((u16)cpu->h << 8) | (u16)cpu->l;
+            u32 result = hl + cpu->sp;
+            cpu->cc.cy = (result > 0xffff);
+            cpu->h = (result & 0xffff) >> 8;
+            cpu->l = result & 0xff;
+        } break;
+        
+        //MVI 
+        case 0x06: cpu->b = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x0e: cpu->c = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x16: cpu->d = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x1e: cpu->e = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x26: cpu->h = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x2e: cpu->l = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+        case 0x36: CORE_WRITE(cpu, mem_offset(cpu), CORE_OPERAND(cpu, 1)); cpu->pc++; break;
+        case 0x3e: cpu->a = CORE_OPERAND(cpu, 1); cpu->pc++; break;
+
+        // INR 
+        case 0x04: cpu->b = increment(cpu, cpu->b); break;
+        case 0x0c: cpu->c = increment(cpu, cpu->c); break;
+        case 0x14: cpu->d = increment(cpu, cpu->d); break;
+        case 0x1c: cpu->e = increment(cpu, cpu->e); break;
+        case 0x24: cpu->h = increment(cpu, cpu->h); break;
+        case 0x2c: cpu->l = increment(cpu, cpu->l); break;
+        case 0x34: CORE_WRITE(cpu, mem_offset(cpu), increment(cpu, CORE_READ(cpu, mem_offset(cpu)))); break;
+        case 0x3c: cpu->a = increment(cpu, cpu->a); break;
+
+        // DCR
+        case 0x05: cpu->b = decrement(cpu, cpu->b); break;
+        case 0x0d: cpu->c = decrement(cpu, cpu->c); break;
+        case 0x15: cpu->d = decrement(cpu, cpu->d); break;
+        case 0x1d: cpu->e = decrement(cpu, cpu->e); break;
+        case 0x25: cpu->h = decrement(cpu, cpu->h); break;
+        case 0x2d: cpu->l = decrement(cpu, cpu->l); break;
+        case 0x35: CORE_WRITE(cpu, mem_offset(cpu), decrement(cpu, CORE_READ(cpu, mem_offset(cpu)))); break;
+        case 0x3d: cpu->a = decrement(cpu, cpu->a); break;
+
+        //MOV B,R
+        case 0x40 ... 0x45: cpu->b = cpu->r[op-0x40+1]; break;
+        case 0x46: cpu->b = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x47: cpu->b = cpu->a; break;
+
+        //MOV C,R
+        case 0x48 ... 0x4d: cpu->c = cpu->r[op-0x48+1]; break;
+        case 0x4e: cpu->c = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x4f: cpu->c = cpu->a; break;
+
+        //MOV D,R
+        case 0x50 ... 0x55: cpu->d = cpu->r[op-0x50+1]; break;
+        case 0x56: cpu->d = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x57: cpu->d = cpu->a; break;
+
+        //MOV E,R
+        case 0x58 ... 0x5d: cpu->e = cpu->r[op-0x58+1]; break;
+        case 0x5e: cpu->e = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x5f: cpu->e = cpu->a; break;
+
+        //MOV H,R
+        case 0x60 ... 0x65: cpu->h = cpu->r[op-0x60+1]; break;
+        case 0x66: cpu->h = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x67: cpu->h = cpu->a; break;
+
+        //MOV L,R
+        case 0x68 ... 0x6d: cpu->l = cpu->r[op-0x68+1]; break;
+        case 0x6e: cpu->l = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x6f: cpu->l = cpu->a; break;
+
+        //MOV M,R
+        case 0x70 ... 0x75: CORE_WRITE(cpu, mem_offset(cpu), cpu->r[op-0x70+1]); break;
+        case 0x77: CORE_WRITE(cpu, mem_offset(cpu), cpu->a); break;
+
+        //MOV A,R
+        case 0x78 ... 0x7d: cpu->a = cpu->r[op-0x78+1]; break;
+        case 0x7e: cpu->a = CORE_READ(cpu, mem_offset(cpu)); break; 
+        case 0x7f: cpu->a = cpu->a; break;
+
+        //ADD
+        case 0x80 ... 0x85: cpu->a = add(cpu, cpu->a, cpu->r[op-0x80+1]); break;
+        case 0x86: cpu->a = add(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0x87: cpu->a = add(cpu, cpu->a, cpu->a); break; 
+
+        //ADC
+        case 0x88 ... 0x8d: cpu->a = carry_add(cpu, cpu->a, cpu->r[op-0x88+1]); break;
+        case 0x8e: cpu->a = carry_add(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break;
+        case 0x8f: cpu->a = carry_add(cpu, cpu->a, cpu->a); break;
+
+        //SUB
+        case 0x90 ... 0x95: cpu->a = sub(cpu, cpu->a, cpu->r[op-0x90+1]); break;
+        case 0x96: cpu->a = sub(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0x97: cpu->a = sub(cpu, cpu->a, cpu->a); break; 
+
+        //SBB
+        case 0x98 ... 0x9d: cpu->a = carry_sub(cpu, cpu->a, cpu->r[op-0x98+1]); break;
+        case 0x9e: cpu->a = carry_sub(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0x9f: cpu->a = carry_sub(cpu, cpu->a, cpu->a); break; 
+
+        //ANA 
+        case 0xa0 ... 0xa5: cpu->a = bitwise_and(cpu, cpu->a, cpu->r[op-0xa0+1]); break;
+        case 0xa6: cpu->a = bitwise_and(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0xa7: cpu->a = bitwise_and(cpu, cpu->a, cpu->a); break; 
+
+        //XRA 
+        case 0xa8 ... 0xad: cpu->a = bitwise_xor(cpu, cpu->a, cpu->r[op-0xa8+1]); break;
+        case 0xae: cpu->a = bitwise_xor(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0xaf: cpu->a = bitwise_xor(cpu, cpu->a, cpu->a); break; 
+
+        //CMP
+        case 0xb8 ... 0xbd: cmp(cpu, cpu->a, cpu->r[op-0xb8+1]); break;
+        case 0xbe: cmp(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0xbf: cmp(cpu, cpu->a, cpu->a); break; 
+
+        //ORA 
+        case 0xb0 ... 0xb5: cpu->a = bitwise_or(cpu, cpu->a, cpu->r[op-0xb0+1]); break;
+        case 0xb6: cpu->a = bitwise_or(cpu, cpu->a, CORE_READ(cpu, mem_offset(cpu))); break; 
+        case 0xb7: cpu->a = bitwise_or(cpu, cpu->a, cpu->a); break; 
+
+        case 0xc6: /* ADI */ cpu->a = add(cpu, cpu->a, CORE_OPERAND(cpu, 1));         cpu->pc++; break; 
+        case 0xce: /* ACI */ cpu->a = carry_add(cpu, cpu->a, CORE_OPERAND(cpu, 1));   cpu->pc++; break; 
+        case 0xd6: /* SUI */ cpu->a = sub(cpu, cpu->a, CORE_OPERAND(cpu, 1));         cpu->pc++; break; 
+        case 0xde: /* SBI */ cpu->a = carry_sub(cpu, cpu->a, CORE_OPERAND(cpu, 1));   cpu->pc++; break; 
+        case 0xe6: /* ANI */ cpu->a = bitwise_and(cpu, cpu->a, CORE_OPERAND(cpu, 1)); cpu->pc++; break;
+        case 0xee: /* XRI */ cpu->a = bitwise_xor(cpu, cpu->a, CORE_OPERAND(cpu, 1)); cpu->pc++; break;
+        case 0xf6: /* ORI */ cpu->a = bitwise_or(cpu, cpu->a, CORE_OPERAND(cpu, 1));  cpu->pc++; break;
+        case 0xfe: /* CPI */ cmp(cpu, cpu->a, CORE_OPERAND(cpu, 1));                    cpu->pc++; break;
+
+        case 0xc1: /* POP B */  CORE_FN(stack_pop_u8_hl)(cpu, &cpu->b, &cpu->c); break;
+        case 0xd1: /* POP D */  CORE_FN(stack_pop_u8_hl)(cpu, &cpu->d, &cpu->e); break;
+        case 0xe1: /* POP H */  CORE_FN(stack_pop_u8_hl)(cpu, &cpu->h, &cpu->l); break;
+
+        case 0xc5: /* PUSH B */ CORE_FN(stack_push_u8_hl)(cpu, cpu->b, cpu->c); break;
+        case 0xd5: /* PUSH D */ CORE_FN(stack_push_u8_hl)(cpu, cpu->d, cpu->e); break;
+        case 0xe5: /* PUSH H */ CORE_FN(stack_push_u8_hl)(cpu, cpu->h, cpu->l); break;
+
+        case 0xf1: { // POP PSW
+            u8 flags = CORE_READ(cpu, cpu->sp + 0);
+            cpu->cc.cy = (flags >> 0) & 1;
+            cpu->cc.p  = (flags >> 2) & 1;
+            cpu->cc.ac = (flags >> 4) & 1;
+            cpu->cc.z  = (flags >> 6) & 1;
+            cpu->cc.s  = (flags >> 7) & 1;
+            cpu->a  = CORE_READ(cpu, cpu->sp + 1);
+            cpu->sp += 2;
+        } break;
+
+        case 0xf5: { // PUSH PSW
+            u8 flags = cpu->cc.cy;
+            flags |= 1 << 1;
+            flags |= cpu->cc.p  << 2;
+            flags |= cpu->cc.ac << 4;
+            flags |= cpu->cc.z  << 6;
+            flags |= cpu->cc.s  << 7;
+            CORE_WRITE(cpu, cpu->sp - 2, flags);
+            CORE_WRITE(cpu, cpu->sp - 1, cpu->a);
+            cpu->sp -= 2;
+        } break;
+
+        case 0xe3: { //XHTL
+            u8 l = CORE_READ(cpu, cpu->sp + 0);
+            u8 h = CORE_READ(cpu, cpu->sp + 1);
+            CORE_WRITE(cpu, cpu->sp + 0, cpu->l);
+            CORE_WRITE(cpu, cpu->sp + 1, cpu->h);
+            cpu->l = l;
+            cpu->h = h;
+        } break;
+        case 0xeb: { //XCHG
+            si_swap(cpu->h, cpu->d, u8);
+            si_swap(cpu->l, cpu->e, u8);
+        } break;
+ 
+        case 0xc9: /* RET */ CORE_FN(ret)(cpu); break; 
+        case 0xd9: /* RET (undocumented) */ CORE_FN(ret)(cpu); break;
+        case 0xc0: /* RNZ */ CORE_FN(ret_if)(cpu, cpu->cc.z  == 0); break; 
+        case 0xc8: /* RZ  */ CORE_FN(ret_if)(cpu, cpu->cc.z  == 1); break; 
+        case 0xd0: /* RNC */ CORE_FN(ret_if)(cpu, cpu->cc.cy == 0); break; 
+        case 0xd8: /* RC  */ CORE_FN(ret_if)(cpu, cpu->cc.cy == 1); break;
+        case 0xe0: /* RPO */ CORE_FN(ret_if)(cpu, cpu->cc.p  == 0); break;
+        case 0xe8: /* RPE */ CORE_FN(ret_if)(cpu, cpu->cc.p  == 1); break;
+        case 0xf0: /* RP  */ CORE_FN(ret_if)(cpu, cpu->cc.s  == 0); break; 
+        case 0xf8: /* RM  */ CORE_FN(ret_if)(cpu, cpu->cc.s  == 1); break;
+            
+        case 0xcd: /* CALL */ CORE_FN(call)(cpu, hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1))); break;
+
+        case 0xdd: /* CALL (undocumented) */
+        case 0xed: /* CALL (undocumented) */
+        case 0xfd: /* CALL (undocumented) */ CORE_FN(call)(cpu, hl_u8(CORE_OPERAND(cpu, 2), CORE_OPERAND(cpu, 1))); break;
+
+        case 0xc4: /* CNZ  */ CORE_FN(call_if)(cpu, cpu->cc.z  == 0, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xcc: /* CZ   */ CORE_FN(call_if)(cpu, cpu->cc.z  == 1, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xd4: /* CNC  */ CORE_FN(call_if)(cpu, cpu->cc.cy == 0, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xdc: /* CC   */ CORE_FN(call_if)(cpu, cpu->cc.cy == 1, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xe4: /* CPO  */ CORE_FN(call_if)(cpu, cpu->cc.p  == 0, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xec: /* CPE  */ CORE_FN(call_if)(cpu, cpu->cc.p  == 1, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xf4: /* CP   */ CORE_FN(call_if)(cpu, cpu->cc.s  == 0, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xfc: /* CM   */ CORE_FN(call_if)(cpu, cpu->cc.s  == 1, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+
+        case 0xc3: /* JMP */ jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xcb: /* JMP (undocumented) */ jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); break;
+        case 0xc2: /* JNZ */ if(cpu->cc.z  == 0) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xca: /* JZ  */ if(cpu->cc.z  == 1) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xd2: /* JNC */ if(cpu->cc.cy == 0) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xda: /* JC  */ if(cpu->cc.cy == 1) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xe2: /* JPO */ if(cpu->cc.p  == 0) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xea: /* JPE */ if(cpu->cc.p  == 1) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xf2: /* JP  */ if(cpu->cc.s  == 0) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+        case 0xfa: /* JM  */ if(cpu->cc.s  == 1) jmp_hl(cpu, CORE_OPERAND(cpu, 1), CORE_OPERAND(cpu, 2)); else cpu->pc += 2; break;
+
+        case 0xf9: /* SPHL */ cpu->sp = (cpu->h << 8) | cpu->l; break; 
+        case 0xe9: /* PCHL */ cpu->pc = (cpu->h << 8) | cpu->l; cpu->pc--; break;
+
+        case 0xc7: /* RST 0 */ CORE_FN(rst)(cpu, 0x00); break;
+        case 0xcf: /* RST 1 */ CORE_FN(rst)(cpu, 0x08); break;
+        case 0xd7: /* RST 2 */ CORE_FN(rst)(cpu, 0x10); break;
+        case 0xdf: /* RST 3 */ CORE_FN(rst)(cpu, 0x18); break;
+        case 0xe7: /* RST 4 */ CORE_FN(rst)(cpu, 0x20); break;
+        case 0xef: /* RST 5 */ CORE_FN(rst)(cpu, 0x28); break;
+        case 0xf7: /* RST 6 */ CORE_FN(rst)(cpu, 0x30); break;
+        case 0xff: /* RST 7 */ CORE_FN(rst)(cpu, 0x38); break;
+
+        case 0x27: /* DAA */ daa(cpu); break;
+        case 0xd3: /* OUT */ CORE_OUT(cpu, CORE_OPERAND(cpu, 1), cpu->a); cpu->pc++; break;
+        case 0xdb: { // IN
+            u8 val = CORE_IN(cpu, CORE_OPERAND(cpu, 1));
+#if CORE_IO_LOG
+            // Leave A as it was so the host sees the state the log went wrong in.
+            if (cpu->log && cpu->log->desync) return 0;
+#endif
+            cpu->a = val;
+            cpu->pc++;
+        } break;
+
+        case 0xf3: /* DI  */ cpu->interruptEnabled = 0; break;
+        case 0xfb: /* EI  */ cpu->interruptEnabled = 1; break;
+
+        case 0x76: { //HLT
+            // Counts as a step, so an interrupt logged after it replays after it
+            // too. pc stays put and stepping on runs it again until one comes.
+            cpu->halted = 1;
+            cpu->steps += 1;
+            return 0;
+        }
+
+        default: {
+            unimplemented_instruction(cpu, op);
+            //printf("Unimplemented: 0x%02x\n", op);
+        } break;
+    }
+    cpu->pc += 1;
+    cpu->steps += 1;
+
+    return 1;
+    // clang-format on
+}
+
+#ifdef CORE_RUN
+internal int
+CORE_RUN(struct cpu_8080 *cpu, u64 end)
+{
+    while (cpu->steps < end) {
+        if (!CORE_STEP(cpu)) return 0;
+    }
+    return 1;
+}
+#endif
+
+// The run_8080 loop for cpu->traps != NULL. Stops before an execution breakpoint,
+// except at the first instruction if resume is set, and with CORE_TRAPS after a
+// watched access. Without CORE_TRAPS watchpoints are ignored, so run_8080 only uses
+// those engines when there are none.
+internal run_result
+CORE_FN(run_traps)(struct cpu_8080 *cpu, u64 end, int resume)
+{
+    run_result result = {0};
+    traps_8080 *traps = cpu->traps;
+    result.reason = STOP_STEP_LIMIT;
+
+    // Without breakpoints this is the plain loop.
+    if (!(traps->all & TRAP_EXEC)) {
+        while (cpu->steps < end) {
+            if (!CORE_STEP(cpu)) {
+                result.reason = STOP_HALT;
+                return result;
+            }
+#if CORE_TRAPS
+            if (cpu->trapHit) return watch_stop(cpu);
+#endif
+        }
+        return result;
+    }
+
+    while (cpu->steps < end) {
+        u16 pc = cpu->pc;
+        if ((traps->pages[pc >> 8] & TRAP_EXEC) && (traps->addrs[pc] & TRAP_EXEC) && !resume) {
+            cpu->resumeBreak = 1;
+            cpu->resumePc = pc;
+            result.reason = STOP_BREAKPOINT;
+            result.addr = pc;
+            result.access = TRAP_EXEC;
+            return result;
+        }
+        resume = 0;
+
+        if (!CORE_STEP(cpu)) {
+            result.reason = STOP_HALT;
+            return result;
+        }
+#if CORE_TRAPS
+        if (cpu->trapHit) return watch_stop(cpu);
+#endif
+    }
+    return result;
+}
+
+#undef CORE_FN_
+#undef CORE_FN_EXPAND
+#undef CORE_FN
+#undef CORE_OPERAND
+#undef CORE_READ
+#undef CORE_WRITE
+#undef CORE_IN
+#undef CORE_OUT
+#undef CORE_ADD_CYCLES
+#undef CORE_STEP
+#undef CORE_RUN
+#undef CORE_TRAPS
+#undef CORE_HASH
+#undef CORE_IO_LOG
+#undef CORE_CYCLES
+#undef CORE_TRACE
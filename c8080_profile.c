@@ -0,0 +1,213 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "c8080_profile.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+internal profiler_8080 *activeProfiler;
+internal struct sigaction previousAction;
+internal struct itimerval previousTimer;
+
+// Address called by the instruction that pushed ret, or -1 if ret doesn't follow
+// a CALL or RST.
+internal i32
+profile_callee(profiler_8080 *p, u16 ret)
+{
+    u8 *m = p->cpu->m;
+    if (ret >= 3 && ret <= p->memSize) {
+        u8 op = m[ret - 3];
+        if (op == 0xcd || (op & 0xc7) == 0xc4 || op == 0xdd || op == 0xed || op == 0xfd) {
+            return m[ret - 2] | (m[ret - 1] << 8);
+        }
+    }
+    if (ret >= 1 && ret <= p->memSize) {
+        u8 op = m[ret - 1];
+        if ((op & 0xc7) == 0xc7) return op & 0x38; // RST n
+    }
+    return -1;
+}
+
+// Runs in the signal handler, only touches the cpu and the ring.
+internal void
+profile_signal(int sig)
+{
+    (void)sig;
+    profiler_8080 *p = activeProfiler;
+    if (!p) return;
+
+    u32 head = p->ringHead;
+    u32 tail = __atomic_load_n(&p->ringTail, __ATOMIC_ACQUIRE);
+    if (head - tail == PROFILE_RING_SIZE) {
+        p->dropped++;
+        return;
+    }
+
+    cpu_8080 *cpu = p->cpu;
+    profile_sample *s = &p->ring[head & (PROFILE_RING_SIZE - 1)];
+    s->pc = cpu->pc;
+    s->depth = 0;
+
+    u32 sp = cpu->sp;
+    for (int i = 0; i < PROFILE_SCAN_WORDS && s->depth < PROFILE_MAX_DEPTH; ++i, sp += 2) {
+        if (sp + 1 >= p->memSize) break;
+        i32 callee = profile_callee(p, cpu->m[sp] | (cpu->m[sp + 1] << 8));
+        if (callee >= 0) s->frames[s->depth++] = callee;
+    }
+    __atomic_store_n(&p->ringHead, head + 1, __ATOMIC_RELEASE);
+}
+
+internal u64
+profile_hash(profile_sample *s)
+{
+    u64 hash = 0xcbf29ce484222325ull; // FNV-1a
+    hash = (hash ^ s->pc) * 0x100000001b3ull;
+    hash = (hash ^ s->depth) * 0x100000001b3ull;
+    for (int i = 0; i < s->depth; ++i) {
+        hash = (hash ^ s->frames[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+internal int
+profile_same(profile_sample *a, profile_sample *b)
+{
+    return a->pc == b->pc && a->depth == b->depth && memcmp(a->frames, b->frames, a->depth * sizeof(u16)) == 0;
+}
+
+// Slot holding s, or the empty slot where it goes. Empty slots have count 0.
+internal profile_entry *
+profile_find(profile_entry *entries, size_t capacity, profile_sample *s)
+{
+    size_t i = profile_hash(s) & (capacity - 1);
+    while (entries[i].count && !profile_same(&entries[i].sample, s)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+internal int
+profile_grow(profiler_8080 *p)
+{
+    size_t capacity = p->entryCapacity * 2;
+    profile_entry *entries = calloc(capacity, sizeof(profile_entry));
+    if (!entries) return 0;
+    for (size_t i = 0; i < p->entryCapacity; ++i) {
+        if (p->entries[i].count) *profile_find(entries, capacity, &p->entries[i].sample) = p->entries[i];
+    }
+    free(p->entries);
+    p->entries = entries;
+    p->entryCapacity = capacity;
+    return 1;
+}
+
+internal void
+profile_add(profiler_8080 *p, profile_sample *s)
+{
+    if ((p->entryCount + 1) * 2 > p->entryCapacity && !profile_grow(p)) return;
+
+    profile_entry *e = profile_find(p->entries, p->entryCapacity, s);
+    if (!e->count) {
+        e->sample = *s;
+        p->entryCount++;
+    }
+    e->count++;
+    p->samples++;
+}
+
+int
+profiler_begin(profiler_8080 *p, cpu_8080 *cpu, size_t memSize, u32 hz)
+{
+    *p = (profiler_8080){0};
+    if (activeProfiler) return 0;
+
+    p->cpu = cpu;
+    p->memSize = memSize < 0x10000 ? memSize : 0x10000;
+    p->ring = calloc(PROFILE_RING_SIZE, sizeof(profile_sample));
+    p->entryCapacity = 1024;
+    p->entries = calloc(p->entryCapacity, sizeof(profile_entry));
+    if (!p->ring || !p->entries) {
+        free(p->ring);
+        free(p->entries);
+        return 0;
+    }
+
+    activeProfiler = p;
+    struct sigaction action = {0};
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previousAction);
+
+    u32 usec = 1000000 / (hz ? hz : PROFILE_DEFAULT_HZ);
+    struct itimerval timer = {0};
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = usec % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, &previousTimer);
+    return 1;
+}
+
+void
+profiler_end(profiler_8080 *p)
+{
+    if (activeProfiler == p) {
+        setitimer(ITIMER_PROF, &previousTimer, NULL);
+        sigaction(SIGPROF, &previousAction, NULL);
+        activeProfiler = NULL;
+    }
+    free(p->ring);
+    free(p->entries);
+    *p = (profiler_8080){0};
+}
+
+void
+profiler_collect(profiler_8080 *p)
+{
+    u32 tail = p->ringTail;
+    u32 head = __atomic_load_n(&p->ringHead, __ATOMIC_ACQUIRE);
+    for (; tail != head; ++tail) {
+        profile_add(p, &p->ring[tail & (PROFILE_RING_SIZE - 1)]);
+    }
+    __atomic_store_n(&p->ringTail, tail, __ATOMIC_RELEASE);
+}
+
+int
+profiler_write_folded(profiler_8080 *p, FILE *f)
+{
+    profiler_collect(p);
+    for (size_t i = 0; i < p->entryCapacity; ++i) {
+        profile_entry *e = &p->entries[i];
+        if (!e->count) continue;
+        for (int frame = e->sample.depth - 1; frame >= 0; --frame) {
+            fprintf(f, "sub_%04x;", e->sample.frames[frame]);
+        }
+        fprintf(f, "0x%04x %llu\n", e->sample.pc, (unsigned long long)e->count);
+    }
+    u64 dropped = __atomic_load_n(&p->dropped, __ATOMIC_RELAXED);
+    if (dropped) fprintf(f, "[dropped] %llu\n", (unsigned long long)dropped);
+    return !ferror(f);
+}
@@ -0,0 +1,90 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef C8080_PROFILE_INCLUDE_GUARD
+#define C8080_PROFILE_INCLUDE_GUARD
+
+#include "c8080.h"
+
+// Sampling profiler for guest code.
+//
+// A SIGPROF timer (setitimer(ITIMER_PROF)) periodically records cpu->pc and the
+// call stack found at cpu->sp. The 8080 has no frame pointers, so the stack is
+// scanned for words that point right after a CALL or RST instruction. Pushed data
+// that happens to look like a return address shows up as an extra frame.
+//
+// Frames are named after the called address (sub_xxxx), the leaf is the sampled pc.
+// Only one profiler can run at a time. In a multithreaded host, block SIGPROF in
+// every thread but the one running the cpu.
+
+#define PROFILE_MAX_DEPTH 16
+#define PROFILE_SCAN_WORDS 64   // stack words looked at per sample
+#define PROFILE_RING_SIZE 4096  // samples buffered between profiler_collect calls
+#define PROFILE_DEFAULT_HZ 997
+
+typedef struct profile_sample {
+    u16 pc;
+    u16 depth;
+    u16 frames[PROFILE_MAX_DEPTH]; // called addresses, innermost first
+} profile_sample;
+
+typedef struct profile_entry {
+    profile_sample sample;
+    u64 count;
+} profile_entry;
+
+typedef struct profiler_8080 {
+    cpu_8080 *cpu;
+    size_t memSize;
+
+    // Written by the signal handler, read by profiler_collect.
+    profile_sample *ring;
+    u32 ringHead;
+    u32 ringTail;
+    u64 dropped; // samples lost because the ring was full
+
+    // Unique stacks and how often they were seen.
+    profile_entry *entries;
+    size_t entryCount;
+    size_t entryCapacity; // power of two
+    u64 samples;
+} profiler_8080;
+
+//Starts sampling cpu hz times per second of cpu time (0 for the default).
+//memSize bounds the stack scan. Returns 1 on success.
+int profiler_begin(profiler_8080 *p, cpu_8080 *cpu, size_t memSize, u32 hz);
+
+//Stops sampling and frees everything. Write the results first.
+void profiler_end(profiler_8080 *p);
+
+//Moves buffered samples into the aggregate. Call it regularly (less often than
+//every PROFILE_RING_SIZE samples) from the thread running the cpu.
+void profiler_collect(profiler_8080 *p);
+
+//Writes the aggregate as folded stacks ("sub_0100;sub_0234;0x0240 12"), the input
+//format of flamegraph.pl and most flame graph tools. Samples lost to a full ring
+//are written as a "[dropped] n" stack. Returns 1 on success.
+int profiler_write_folded(profiler_8080 *p, FILE *f);
+
+#endif //C8080_PROFILE_INCLUDE_GUARD
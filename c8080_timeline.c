@@ -0,0 +1,303 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "c8080_timeline.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+internal void
+checkpoint_save(timeline_8080 *tl, checkpoint_8080 *ck)
+{
+    cpu_8080 *cpu = tl->cpu;
+    io_log *log = cpu->log;
+
+    ck->steps = cpu->steps;
+    ck->cycles = cpu->cycles;
+    ck->logCursor = log->mode == IO_LOG_REPLAY ? log->cursor : log->count;
+    memcpy(ck->r, cpu->r, sizeof(ck->r));
+    ck->sp = cpu->sp;
+    ck->pc = cpu->pc;
+    ck->cc = cpu->cc;
+    ck->interruptEnabled = cpu->interruptEnabled;
+    ck->halted = cpu->halted;
+    memcpy(ck->m, cpu->m, tl->memSize);
+}
+
+internal void
+checkpoint_restore(timeline_8080 *tl, checkpoint_8080 *ck)
+{
+    cpu_8080 *cpu = tl->cpu;
+    io_log *log = cpu->log;
+
+    cpu->steps = ck->steps;
+    cpu->cycles = ck->cycles;
+    memcpy(cpu->r, ck->r, sizeof(ck->r));
+    cpu->sp = ck->sp;
+    cpu->pc = ck->pc;
+    cpu->cc = ck->cc;
+    cpu->interruptEnabled = ck->interruptEnabled;
+    cpu->halted = ck->halted;
+    memcpy(cpu->m, ck->m, tl->memSize);
+    if (cpu->hash) state_hash_reset(cpu);
+    cpu->trapHit = 0;
+    cpu->resumeBreak = 0;
+
+    // Everything up to head happened already, replay its inputs and only go
+    // back to recording once we get there again. A replayed log may go on past
+    // head and keep replaying after it.
+    log->mode = IO_LOG_REPLAY;
+    log->cursor = ck->logCursor;
+    log->resumeStep = tl->head > tl->resumeStep ? tl->head : tl->resumeStep;
+    log->desync = 0;
+}
+
+// Drops every other checkpoint in the older half of the history. The recent
+// half keeps its spacing so stepping back near the present stays cheap, while
+// the span covered by the budget keeps growing.
+internal void
+timeline_thin(timeline_8080 *tl)
+{
+    size_t half = tl->count / 2;
+    size_t kept = 0;
+    for (size_t i = 0; i < tl->count; ++i) {
+        if (i < half && (i & 1)) {
+            free(tl->checkpoints[i].m);
+            continue;
+        }
+        tl->checkpoints[kept++] = tl->checkpoints[i];
+    }
+    tl->count = kept;
+}
+
+// Memory the checkpoints from first on and the events they need take up. The
+// event array can be up to twice the size of what is in it. Events a replay
+// hasn't reached yet aren't history.
+internal size_t
+timeline_usage(timeline_8080 *tl, size_t first)
+{
+    io_log *log = tl->cpu->log;
+    size_t end = log->mode == IO_LOG_REPLAY ? log->cursor : log->count;
+    size_t events = end - tl->checkpoints[first].logCursor;
+    return (tl->count - first) * (tl->memSize + sizeof(checkpoint_8080)) + 2 * events * sizeof(io_event);
+}
+
+// Drops the oldest checkpoints until there is room for need more bytes, and the
+// events only they needed.
+internal void
+timeline_trim(timeline_8080 *tl, size_t need)
+{
+    size_t drop = 0;
+    while (tl->count - drop > 1 && timeline_usage(tl, drop) + need > tl->memBudget) {
+        free(tl->checkpoints[drop++].m);
+    }
+    if (!drop) return;
+
+    tl->count -= drop;
+    memmove(tl->checkpoints, tl->checkpoints + drop, tl->count * sizeof(checkpoint_8080));
+    size_t discard = tl->checkpoints[0].logCursor;
+    io_log_discard(tl->cpu->log, discard);
+    for (size_t i = 0; i < tl->count; ++i) {
+        tl->checkpoints[i].logCursor -= discard;
+    }
+}
+
+internal int
+timeline_checkpoint(timeline_8080 *tl)
+{
+    // Thinning keeps the span of history the budget covers. It never drops the
+    // oldest checkpoint though, so when the logged inputs alone outgrow the
+    // budget the oldest checkpoints and their events have to go.
+    size_t size = tl->memSize + sizeof(checkpoint_8080);
+    if (tl->count == tl->maxCheckpoints) timeline_thin(tl);
+    while (tl->count >= 4 && timeline_usage(tl, 0) + size > tl->memBudget) timeline_thin(tl);
+    timeline_trim(tl, size);
+
+    checkpoint_8080 *ck = &tl->checkpoints[tl->count];
+    ck->m = malloc(tl->memSize);
+    if (!ck->m) return 0;
+    checkpoint_save(tl, ck);
+    tl->count++;
+    return 1;
+}
+
+// Index of the newest checkpoint at or before step. The caller makes sure
+// step isn't before the oldest one.
+internal size_t
+timeline_find(timeline_8080 *tl, u64 step)
+{
+    size_t lo = 0, hi = tl->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tl->checkpoints[mid].steps <= step) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Replays up to step without stopping at the host's breakpoints or tracing.
+internal void
+timeline_run_to(timeline_8080 *tl, u64 step)
+{
+    cpu_8080 *cpu = tl->cpu;
+    traps_8080 *traps = cpu->traps;
+    trace_fn trace = cpu->trace;
+    cpu->traps = NULL;
+    cpu->trace = NULL;
+    cpu->trapHit = 0; // belongs to where we came from
+    // A HLT stops run_8080 but still counts as a step, only a desync makes no progress.
+    while (cpu->steps < step) {
+        u64 steps = cpu->steps;
+        run_8080(cpu, step - cpu->steps);
+        if (cpu->steps == steps) break;
+    }
+    cpu->traps = traps;
+    cpu->trace = trace;
+}
+
+int
+timeline_begin(timeline_8080 *tl, cpu_8080 *cpu, size_t memSize, size_t memBudget, u64 interval)
+{
+    *tl = (timeline_8080){0};
+    tl->cpu = cpu;
+    tl->memSize = memSize;
+    tl->interval = interval ? interval : TIMELINE_DEFAULT_INTERVAL;
+    tl->head = cpu->steps;
+
+    tl->memBudget = memBudget;
+    tl->maxCheckpoints = memBudget / (memSize + sizeof(checkpoint_8080));
+    if (tl->maxCheckpoints < 4) tl->maxCheckpoints = 4;
+    tl->checkpoints = calloc(tl->maxCheckpoints, sizeof(checkpoint_8080));
+    if (!tl->checkpoints) return 0;
+
+    if (!cpu->log || cpu->log->mode == IO_LOG_OFF) {
+        io_log_record(cpu, &tl->ownLog, NULL);
+    } else if (cpu->log->mode == IO_LOG_REPLAY) {
+        tl->resumeStep = cpu->log->resumeStep;
+    }
+    if (!timeline_checkpoint(tl)) {
+        timeline_end(tl);
+        return 0;
+    }
+    return 1;
+}
+
+void
+timeline_end(timeline_8080 *tl)
+{
+    for (size_t i = 0; i < tl->count; ++i) {
+        free(tl->checkpoints[i].m);
+    }
+    free(tl->checkpoints);
+    if (tl->cpu && tl->cpu->log == &tl->ownLog) io_log_close(tl->cpu, &tl->ownLog);
+    *tl = (timeline_8080){0};
+}
+
+int
+timeline_step(timeline_8080 *tl)
+{
+    cpu_8080 *cpu = tl->cpu;
+    if (cpu->steps >= tl->checkpoints[tl->count - 1].steps + tl->interval) {
+        timeline_checkpoint(tl);
+    }
+
+    int result = emulate_8080(cpu);
+    if (cpu->steps > tl->head) tl->head = cpu->steps;
+    return result;
+}
+
+int
+timeline_seek(timeline_8080 *tl, u64 step)
+{
+    cpu_8080 *cpu = tl->cpu;
+    if (step > tl->head || step < tl->checkpoints[0].steps) return 0;
+
+    if (step < cpu->steps) {
+        checkpoint_restore(tl, &tl->checkpoints[timeline_find(tl, step)]);
+    }
+    timeline_run_to(tl, step);
+
+    // Back at the end of history, take new inputs from the host right away.
+    io_log *log = cpu->log;
+    if (log->mode == IO_LOG_REPLAY && cpu->steps >= log->resumeStep && log->cursor == log->count) {
+        log->mode = IO_LOG_RECORD;
+    }
+    return cpu->steps == step;
+}
+
+int
+timeline_reverse_step(timeline_8080 *tl)
+{
+    u64 steps = tl->cpu->steps;
+    if (steps == 0) return 0;
+    return timeline_seek(tl, steps - 1);
+}
+
+int
+timeline_last_write(timeline_8080 *tl, u16 addr)
+{
+    cpu_8080 *cpu = tl->cpu;
+    u64 start = cpu->steps;
+    if (start <= tl->checkpoints[0].steps) return 0;
+
+    traps_8080 *search = calloc(1, sizeof(traps_8080));
+    if (!search) return 0;
+    traps_set(search, addr, TRAP_WRITE);
+
+    // Search one checkpoint interval at a time, newest first, and remember the
+    // last store to addr within it.
+    traps_8080 *traps = cpu->traps;
+    trace_fn trace = cpu->trace;
+    cpu->trace = NULL;
+    u64 end = start;
+    size_t i = timeline_find(tl, end - 1);
+    u64 writeStep = 0;
+    int found = 0;
+    for (;;) {
+        checkpoint_8080 *ck = &tl->checkpoints[i];
+        checkpoint_restore(tl, ck);
+
+        cpu->traps = search;
+        while (cpu->steps < end) {
+            u64 steps = cpu->steps;
+            run_result r = run_8080(cpu, end - cpu->steps);
+            if (r.reason == STOP_WATCH_WRITE) {
+                writeStep = cpu->steps - 1;
+                found = 1;
+            } else if (r.reason != STOP_STEP_LIMIT && cpu->steps == steps) {
+                break;
+            }
+        }
+        cpu->traps = traps;
+
+        if (found || i == 0) break;
+        end = ck->steps;
+        --i;
+    }
+    cpu->trace = trace;
+    free(search);
+
+    timeline_seek(tl, found ? writeStep : start);
+    return found;
+}
@@ -0,0 +1,94 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef C8080_TIMELINE_INCLUDE_GUARD
+#define C8080_TIMELINE_INCLUDE_GUARD
+
+#include "c8080.h"
+
+// Reverse execution for the 8080 core.
+//
+// The timeline keeps periodic checkpoints (registers + a full copy of memory) and
+// records every input through the cpu's io_log. Going back in time restores the
+// nearest checkpoint at or before the target and replays forward to it. The cpu can
+// also be replaying a log (e.g. one from the field), its events are the history then.
+// Devices must only affect the cpu through IN and interrupts for this to work.
+
+typedef struct checkpoint_8080 {
+    u64 steps;
+    u64 cycles;
+    size_t logCursor;
+    u8 r[7];
+    u16 sp;
+    u16 pc;
+    condition_codes cc;
+    u8 interruptEnabled;
+    u8 halted;
+    u8 *m;
+} checkpoint_8080;
+
+typedef struct timeline_8080 {
+    cpu_8080 *cpu;
+    size_t memSize;      // bytes of cpu->m saved in each checkpoint
+
+    checkpoint_8080 *checkpoints; // oldest first
+    size_t count;
+    size_t maxCheckpoints;        // derived from the memory budget
+    size_t memBudget;             // for the checkpoints and the in-memory log
+    u64 interval;                 // steps between the most recent checkpoints
+
+    u64 head;            // furthest step executed, the end of recorded history
+    u64 resumeStep;      // resumeStep of the log the cpu was replaying, 0 if it was recording
+    io_log ownLog;       // used when the cpu has no log
+} timeline_8080;
+
+#define TIMELINE_DEFAULT_INTERVAL (1 << 16)
+
+//Starts keeping history for cpu. memBudget is the most memory checkpoints and the
+//logged events may use together, interval the number of steps between checkpoints
+//(0 for the default). Starts recording into an in-memory log unless cpu has a log.
+//A log that is replaying keeps replaying, and only goes back to recording where it
+//would have without the timeline. Events older than the oldest checkpoint are
+//discarded from the log, ones the replay hasn't reached yet don't count against the
+//budget. Returns 1 on success.
+int timeline_begin(timeline_8080 *tl, cpu_8080 *cpu, size_t memSize, size_t memBudget, u64 interval);
+
+//Frees the checkpoints, and the log if the timeline created it.
+void timeline_end(timeline_8080 *tl);
+
+//Use in place of emulate_8080 while a timeline is active. Same return value.
+int timeline_step(timeline_8080 *tl);
+
+//Moves the cpu to any step between the oldest checkpoint and head.
+//Returns 1 if cpu->steps == step afterwards.
+int timeline_seek(timeline_8080 *tl, u64 step);
+
+//Undoes the last instruction. Returns 0 if there is no history before it.
+int timeline_reverse_step(timeline_8080 *tl);
+
+//Goes back to the last instruction that stored to addr and stops right before it
+//executes. Returns 0 (and leaves the cpu where it was) if there is none in history.
+int timeline_last_write(timeline_8080 *tl, u16 addr);
+
+#endif //C8080_TIMELINE_INCLUDE_GUARD
@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "c8080_visited.h"
+#include <stdlib.h>
+
+#define VISITED_MIN_CAPACITY 1024
+
+// Fingerprints are well mixed already, their low bits pick the slot.
+internal size_t
+visited_find(u64 *slots, size_t capacity, u64 fingerprint)
+{
+    size_t mask = capacity - 1;
+    size_t i = fingerprint & mask;
+    while (slots[i] && slots[i] != fingerprint) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+internal int
+visited_grow(visited_set *set)
+{
+    size_t capacity = set->capacity ? set->capacity * 2 : VISITED_MIN_CAPACITY;
+    u64 *slots = calloc(capacity, sizeof(u64));
+    if (!slots) return 0;
+
+    for (size_t i = 0; i < set->capacity; ++i) {
+        u64 key = set->slots[i];
+        if (key) slots[visited_find(slots, capacity, key)] = key;
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+    return 1;
+}
+
+int
+visited_insert(visited_set *set, u64 fingerprint)
+{
+    // 0 marks a free slot, it can't be stored in one.
+    if (!fingerprint) {
+        if (set->hasZero) return 0;
+        set->hasZero = 1;
+        set->count++;
+        return 1;
+    }
+
+    // Keep the load under one half so probes stay short.
+    if ((set->count + 1) * 2 > set->capacity && !visited_grow(set)) return -1;
+
+    size_t i = visited_find(set->slots, set->capacity, fingerprint);
+    if (set->slots[i]) return 0;
+    set->slots[i] = fingerprint;
+    set->count++;
+    return 1;
+}
+
+int
+visited_contains(visited_set *set, u64 fingerprint)
+{
+    if (!fingerprint) return set->hasZero;
+    if (!set->capacity) return 0;
+    return set->slots[visited_find(set->slots, set->capacity, fingerprint)] == fingerprint;
+}
+
+void
+visited_clear(visited_set *set)
+{
+    free(set->slots);
+    *set = (visited_set){0};
+}
@@ -0,0 +1,53 @@
+/*
+MIT License
+
+Copyright (c) 2022 Jeremy Montgomery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef C8080_VISITED_INCLUDE_GUARD
+#define C8080_VISITED_INCLUDE_GUARD
+
+#include "c8080.h"
+
+// Set of state fingerprints (see state_fingerprint) for search drivers that want
+// to skip states they have already explored. Only the 64-bit fingerprints are
+// stored, so two different states can in principle collide; even with a few
+// hundred million states the odds of any collision are well under one percent.
+//
+// A zeroed visited_set is empty and ready to use.
+typedef struct visited_set {
+    u64 *slots;         // open addressing, 0 marks a free slot
+    size_t count;       // fingerprints in the set, including 0
+    size_t capacity;    // power of two
+    u8 hasZero;         // 0 is in the set, it has no slot
+} visited_set;
+
+//Adds fingerprint to the set. Returns 1 if it wasn't in it yet, 0 if it was and
+//-1 if the set couldn't grow.
+int visited_insert(visited_set *set, u64 fingerprint);
+
+//Returns 1 if fingerprint is in the set.
+int visited_contains(visited_set *set, u64 fingerprint);
+
+//Frees the slots and leaves an empty set.
+void visited_clear(visited_set *set);
+
+#endif //C8080_VISITED_INCLUDE_GUARD
@@ -0,0 +1,14 @@
+// The single switch core from before the engines in c8080_core.inl, unchanged in
+// this folder. bench.c compares against it, build it in its own translation unit:
+// `gcc -O2 bench.c baseline/baseline.c -o bench`
+#define emulate_8080 baseline_emulate_8080
+#include "c8080.c"
+
+void
+baseline_run(u8 *m, u16 pc, long steps)
+{
+    struct cpu_8080 cpu = {};
+    cpu.m = m;
+    cpu.pc = pc;
+    for (long i = 0; i < steps; ++i) emulate_8080(&cpu);
+}
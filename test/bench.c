@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../c8080.c"
+#include "../c8080_profile.c"
+
+// Throughput of the different engines on a small loop that mixes register,
+// memory and stack instructions, next to the core they replaced. Build with
+// optimizations, e.g. `gcc -O2 bench.c baseline/baseline.c -o bench`
+//
+//   LXI SP,0xf000
+//   LXI H,0x2000
+// loop:
+//   MOV A,M / ADD B / MOV M,A / INX H
+//   MOV A,H / ANI 0x2f / MOV H,A
+//   PUSH B / POP B / INR B / CMP C
+//   JMP loop
+static const u8 program[] = {
+    0x31, 0x00, 0xf0, 0x21, 0x00, 0x20,
+    0x7e, 0x80, 0x77, 0x23, 0x7c, 0xe6, 0x2f, 0x67,
+    0xc5, 0xc1, 0x04, 0xb9, 0xc3, 0x06, 0x01,
+};
+
+#define BENCH_STEPS 200000000
+
+static double
+seconds_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void
+reset(struct cpu_8080 *cpu)
+{
+    u8 *m = cpu->m;
+    memset(cpu, 0, sizeof(*cpu));
+    memset(m, 0, 0x10000);
+    memcpy(m + 0x100, program, sizeof(program));
+    cpu->m = m;
+    cpu->pc = 0x100;
+}
+
+static void
+report(const char *name, double seconds)
+{
+    printf("%-20s %8.1f M instructions/s\n", name, BENCH_STEPS / seconds / 1e6);
+}
+
+// baseline/baseline.c
+void baseline_run(u8 *m, u16 pc, long steps);
+
+int main(void)
+{
+    struct cpu_8080 cpu = {};
+    cpu.m = malloc(0x10000);
+
+    reset(&cpu);
+    double start = seconds_now();
+    baseline_run(cpu.m, cpu.pc, BENCH_STEPS);
+    report("baseline switch", seconds_now() - start);
+
+    reset(&cpu);
+    start = seconds_now();
+    for (int i = 0; i < BENCH_STEPS; ++i) emulate_8080_flat(&cpu);
+    report("emulate_8080_flat", seconds_now() - start);
+
+    reset(&cpu);
+    start = seconds_now();
+    for (int i = 0; i < BENCH_STEPS; ++i) emulate_8080(&cpu);
+    report("emulate_8080", seconds_now() - start);
+
+    reset(&cpu);
+    cpu.countCycles = 1;
+    start = seconds_now();
+    for (int i = 0; i < BENCH_STEPS; ++i) emulate_8080(&cpu);
+    report("emulate_8080 + cycles", seconds_now() - start);
+
+    reset(&cpu);
+    start = seconds_now();
+    run_8080(&cpu, BENCH_STEPS);
+    report("run_8080", seconds_now() - start);
+
+    // One store per loop iteration updates the hash.
+    state_hash_8080 *hash = malloc(sizeof(state_hash_8080));
+    reset(&cpu);
+    state_hash_attach(&cpu, hash, 0x10000);
+    start = seconds_now();
+    run_8080(&cpu, BENCH_STEPS);
+    report("run_8080 + hash", seconds_now() - start);
+
+    // Traps attached but none set, then a watchpoint and a breakpoint on a page the
+    // loop never touches. With only watchpoints run_8080 uses the traps-only engine,
+    // breakpoints are checked by the plain one.
+    traps_8080 *traps = calloc(1, sizeof(traps_8080));
+    reset(&cpu);
+    cpu.traps = traps;
+    start = seconds_now();
+    run_8080(&cpu, BENCH_STEPS);
+    report("run_8080 + traps", seconds_now() - start);
+
+    traps_set(traps, 0x8000, TRAP_READ | TRAP_WRITE);
+    reset(&cpu);
+    cpu.traps = traps;
+    start = seconds_now();
+    run_8080(&cpu, BENCH_STEPS);
+    report("run_8080 + watch", seconds_now() - start);
+
+    traps_clear(traps, 0x8000, TRAP_READ | TRAP_WRITE);
+    traps_set(traps, 0x8000, TRAP_EXEC);
+    reset(&cpu);
+    cpu.traps = traps;
+    start = seconds_now();
+    run_8080(&cpu, BENCH_STEPS);
+    report("run_8080 + break", seconds_now() - start);
+
+    // The sampling profiler, collecting every 1M steps like a host loop would.
+    profiler_8080 profiler;
+    reset(&cpu);
+    profiler_begin(&profiler, &cpu, 0x10000, 0);
+    start = seconds_now();
+    for (int i = 0; i < BENCH_STEPS / 1000000; ++i) {
+        run_8080(&cpu, 1000000);
+        profiler_collect(&profiler);
+    }
+    report("run_8080 + profiler", seconds_now() - start);
+    profiler_end(&profiler);
+
+    return 0;
+}
@@ -0,0 +1,1017 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../c8080.c"
+
+// Differential fuzzer for the 8080 core.
+//
+// Every case starts from a random machine state with random bytes to execute, and
+// runs them one instruction at a time on one of the core's engines and on the
+// reference model below. Registers, flags, cycles, port output and the bytes the
+// instruction stored are compared after each instruction, and all of memory at the
+// end of the case. The first mismatch is shrunk to a single instruction from a
+// minimal state and printed.
+//
+// Build with `gcc -O2 fuzz.c -o fuzz -lpthread`
+// Usage: ./fuzz [-j threads] [-t seconds] [-n cases] [-s first seed]
+
+#define CASE_STEPS 1024
+#define MEM_SIZE 0x10000
+
+//
+// Reference model. Decoding is driven by ref_ops[], the semantics follow the Intel
+// 8080 manual and don't share any code with the core.
+//
+
+enum ref_kind {
+    K_NOP, K_LXI, K_STAX, K_LDAX, K_SHLD, K_LHLD, K_STA, K_LDA, K_INX, K_DCX, K_INR,
+    K_DCR, K_MVI, K_DAD, K_RLC, K_RRC, K_RAL, K_RAR, K_DAA, K_CMA, K_STC, K_CMC,
+    K_MOV, K_HLT, K_ALU, K_ALUI, K_RCC, K_RET, K_POP, K_JCC, K_JMP, K_CCC, K_CALL,
+    K_PUSH, K_RST, K_OUT, K_IN, K_XTHL, K_PCHL, K_XCHG, K_SPHL, K_DI, K_EI,
+};
+
+typedef struct ref_op {
+    u8 kind;
+    u8 length;
+    u8 cycles;
+    u8 cyclesTaken; // conditional calls and returns
+} ref_op;
+
+static ref_op ref_ops[256];
+
+#define F_CY 0x01
+#define F_P  0x04
+#define F_AC 0x10
+#define F_Z  0x40
+#define F_S  0x80
+#define F_MASK (F_S | F_Z | F_AC | F_P | F_CY)
+
+#define REG_M 6
+#define REG_A 7
+
+typedef struct ref_cpu {
+    u8 reg[8];  // by the 3 bit register field: B C D E H L (M) A
+    u8 f;       // flags as pushed by PUSH PSW
+    u16 sp;
+    u16 pc;
+    u8 ie;
+    u8 halted;
+    u8 *m;
+    u64 steps;
+    u64 cycles;
+    u64 salt;   // makes IN values differ between cases
+
+    // Accesses of the last step, for comparing and shrinking.
+    u16 reads[8];
+    u8 readCount;
+    u16 writes[4];
+    u8 writeCount;
+    u8 outPort, outValue, outCount;
+} ref_cpu;
+
+static void
+ref_set_op(u8 op, u8 kind, u8 length, u8 cycles, u8 cyclesTaken)
+{
+    ref_ops[op] = (ref_op){ kind, length, cycles, cyclesTaken };
+}
+
+static void
+ref_init_ops(void)
+{
+    for (int op = 0; op < 256; ++op) ref_set_op(op, K_NOP, 1, 4, 4);
+
+    for (int rp = 0; rp < 4; ++rp) {
+        ref_set_op(0x01 | rp << 4, K_LXI, 3, 10, 10);
+        ref_set_op(0x03 | rp << 4, K_INX, 1, 5, 5);
+        ref_set_op(0x09 | rp << 4, K_DAD, 1, 10, 10);
+        ref_set_op(0x0b | rp << 4, K_DCX, 1, 5, 5);
+        ref_set_op(0xc1 | rp << 4, K_POP, 1, 10, 10);
+        ref_set_op(0xc5 | rp << 4, K_PUSH, 1, 11, 11);
+    }
+    for (int r = 0; r < 8; ++r) {
+        ref_set_op(0x04 | r << 3, K_INR, 1, r == REG_M ? 10 : 5, 0);
+        ref_set_op(0x05 | r << 3, K_DCR, 1, r == REG_M ? 10 : 5, 0);
+        ref_set_op(0x06 | r << 3, K_MVI, 2, r == REG_M ? 10 : 7, 0);
+    }
+    for (int dst = 0; dst < 8; ++dst) {
+        for (int src = 0; src < 8; ++src) {
+            u8 cycles = (dst == REG_M || src == REG_M) ? 7 : 5;
+            ref_set_op(0x40 | dst << 3 | src, K_MOV, 1, cycles, cycles);
+        }
+    }
+    ref_set_op(0x76, K_HLT, 1, 7, 7);
+    for (int op = 0x80; op < 0xc0; ++op) {
+        ref_set_op(op, K_ALU, 1, (op & 7) == REG_M ? 7 : 4, 0);
+    }
+    for (int cc = 0; cc < 8; ++cc) {
+        ref_set_op(0xc0 | cc << 3, K_RCC, 1, 5, 11);
+        ref_set_op(0xc2 | cc << 3, K_JCC, 3, 10, 10);
+        ref_set_op(0xc4 | cc << 3, K_CCC, 3, 11, 17);
+        ref_set_op(0xc6 | cc << 3, K_ALUI, 2, 7, 7);
+        ref_set_op(0xc7 | cc << 3, K_RST, 1, 11, 11);
+    }
+
+    ref_set_op(0x02, K_STAX, 1, 7, 7);
+    ref_set_op(0x12, K_STAX, 1, 7, 7);
+    ref_set_op(0x0a, K_LDAX, 1, 7, 7);
+    ref_set_op(0x1a, K_LDAX, 1, 7, 7);
+    ref_set_op(0x22, K_SHLD, 3, 16, 16);
+    ref_set_op(0x2a, K_LHLD, 3, 16, 16);
+    ref_set_op(0x32, K_STA, 3, 13, 13);
+    ref_set_op(0x3a, K_LDA, 3, 13, 13);
+    ref_set_op(0x07, K_RLC, 1, 4, 4);
+    ref_set_op(0x0f, K_RRC, 1, 4, 4);
+    ref_set_op(0x17, K_RAL, 1, 4, 4);
+    ref_set_op(0x1f, K_RAR, 1, 4, 4);
+    ref_set_op(0x27, K_DAA, 1, 4, 4);
+    ref_set_op(0x2f, K_CMA, 1, 4, 4);
+    ref_set_op(0x37, K_STC, 1, 4, 4);
+    ref_set_op(0x3f, K_CMC, 1, 4, 4);
+    ref_set_op(0xc3, K_JMP, 3, 10, 10);
+    ref_set_op(0xcb, K_JMP, 3, 10, 10);
+    ref_set_op(0xc9, K_RET, 1, 10, 10);
+    ref_set_op(0xd9, K_RET, 1, 10, 10);
+    ref_set_op(0xcd, K_CALL, 3, 17, 17);
+    ref_set_op(0xdd, K_CALL, 3, 17, 17);
+    ref_set_op(0xed, K_CALL, 3, 17, 17);
+    ref_set_op(0xfd, K_CALL, 3, 17, 17);
+    ref_set_op(0xd3, K_OUT, 2, 10, 10);
+    ref_set_op(0xdb, K_IN, 2, 10, 10);
+    ref_set_op(0xe3, K_XTHL, 1, 18, 18);
+    ref_set_op(0xe9, K_PCHL, 1, 5, 5);
+    ref_set_op(0xeb, K_XCHG, 1, 4, 4);
+    ref_set_op(0xf9, K_SPHL, 1, 5, 5);
+    ref_set_op(0xf3, K_DI, 1, 4, 4);
+    ref_set_op(0xfb, K_EI, 1, 4, 4);
+}
+
+static u64
+mix64(u64 x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Value read by IN, shared by both models.
+static u8
+fuzz_in_value(u64 salt, u8 port, u64 steps)
+{
+    return mix64(salt ^ ((u64)port << 56) ^ steps) & 0xff;
+}
+
+static u8
+ref_read(ref_cpu *c, u16 addr)
+{
+    c->reads[c->readCount++] = addr;
+    return c->m[addr];
+}
+
+static void
+ref_write(ref_cpu *c, u16 addr, u8 val)
+{
+    c->writes[c->writeCount++] = addr;
+    c->m[addr] = val;
+}
+
+static u16
+ref_hl(ref_cpu *c)
+{
+    return c->reg[4] << 8 | c->reg[5];
+}
+
+static u8
+ref_get(ref_cpu *c, int r)
+{
+    return r == REG_M ? ref_read(c, ref_hl(c)) : c->reg[r];
+}
+
+static void
+ref_set(ref_cpu *c, int r, u8 val)
+{
+    if (r == REG_M) ref_write(c, ref_hl(c), val);
+    else c->reg[r] = val;
+}
+
+// Register pairs BC, DE, HL, SP
+static u16
+ref_get_rp(ref_cpu *c, int rp)
+{
+    return rp == 3 ? c->sp : (c->reg[rp * 2] << 8 | c->reg[rp * 2 + 1]);
+}
+
+static void
+ref_set_rp(ref_cpu *c, int rp, u16 val)
+{
+    if (rp == 3) {
+        c->sp = val;
+    } else {
+        c->reg[rp * 2] = val >> 8;
+        c->reg[rp * 2 + 1] = val & 0xff;
+    }
+}
+
+static void
+ref_push(ref_cpu *c, u16 val)
+{
+    ref_write(c, c->sp - 1, val >> 8);
+    ref_write(c, c->sp - 2, val & 0xff);
+    c->sp -= 2;
+}
+
+static u16
+ref_pop(ref_cpu *c)
+{
+    u16 val = ref_read(c, c->sp) | ref_read(c, c->sp + 1) << 8;
+    c->sp += 2;
+    return val;
+}
+
+static u8
+ref_zsp(u8 val)
+{
+    int ones = 0;
+    for (int i = 0; i < 8; ++i) ones += (val >> i) & 1;
+    return (val == 0 ? F_Z : 0) | (val & 0x80 ? F_S : 0) | (ones % 2 == 0 ? F_P : 0);
+}
+
+static void
+ref_set_flags(ref_cpu *c, u8 flags)
+{
+    c->f = (flags & F_MASK) | 0x02;
+}
+
+// a + b + carry with Z S P AC CY
+static u8
+ref_add(ref_cpu *c, u8 a, u8 b, int carry)
+{
+    int sum = a + b + carry;
+    int low = (a & 0xf) + (b & 0xf) + carry;
+    u8 result = sum & 0xff;
+    ref_set_flags(c, ref_zsp(result) | (low > 0xf ? F_AC : 0) | (sum > 0xff ? F_CY : 0));
+    return result;
+}
+
+// Subtraction is addition of the complement, the carry out is the inverted borrow.
+static u8
+ref_sub(ref_cpu *c, u8 a, u8 b, int borrow)
+{
+    u8 result = ref_add(c, a, ~b, !borrow);
+    c->f ^= F_CY;
+    return result;
+}
+
+static void
+ref_alu(ref_cpu *c, int op, u8 val)
+{
+    u8 a = c->reg[REG_A];
+    int cy = c->f & F_CY;
+    switch (op) {
+        case 0: c->reg[REG_A] = ref_add(c, a, val, 0); break;   // ADD
+        case 1: c->reg[REG_A] = ref_add(c, a, val, cy); break;  // ADC
+        case 2: c->reg[REG_A] = ref_sub(c, a, val, 0); break;   // SUB
+        case 3: c->reg[REG_A] = ref_sub(c, a, val, cy); break;  // SBB
+        case 4: // ANA, AC is the or of bit 3 of the operands on the 8080
+            c->reg[REG_A] = a & val;
+            ref_set_flags(c, ref_zsp(a & val) | ((a | val) & 0x08 ? F_AC : 0));
+            break;
+        case 5: c->reg[REG_A] = a ^ val; ref_set_flags(c, ref_zsp(a ^ val)); break; // XRA
+        case 6: c->reg[REG_A] = a | val; ref_set_flags(c, ref_zsp(a | val)); break; // ORA
+        case 7: ref_sub(c, a, val, 0); break;                   // CMP
+    }
+}
+
+// NZ Z NC C PO PE P M
+static int
+ref_cond(ref_cpu *c, int cc)
+{
+    static const u8 flag[4] = { F_Z, F_CY, F_P, F_S };
+    return ((c->f & flag[cc >> 1]) != 0) == (cc & 1);
+}
+
+static void
+ref_daa(ref_cpu *c)
+{
+    // Per the manual: first fix the low digit, then the high digit of the result.
+    u8 a = c->reg[REG_A];
+    u8 cy = c->f & F_CY;
+    u8 ac = 0;
+    if ((a & 0x0f) > 9 || (c->f & F_AC)) {
+        ac = (a & 0x0f) + 6 > 0x0f;
+        if (a + 6 > 0xff) cy = 1;
+        a += 6;
+    }
+    if ((a >> 4) > 9 || cy) {
+        a += 0x60;
+        cy = 1;
+    }
+    c->reg[REG_A] = a;
+    ref_set_flags(c, ref_zsp(a) | (ac ? F_AC : 0) | (cy ? F_CY : 0));
+}
+
+static int
+ref_interrupt(ref_cpu *c, int num)
+{
+    if (!c->ie) return 0;
+    ref_push(c, c->halted && ref_read(c, c->pc) == 0x76 ? c->pc + 1 : c->pc);
+    c->halted = 0;
+    c->pc = num * 8;
+    c->ie = 0;
+    return 1;
+}
+
+// Returns 0 on HLT. It counts as a step but leaves pc on the HLT, halted until an
+// interrupt returns past it.
+static int
+ref_step(ref_cpu *c)
+{
+    u8 op = ref_read(c, c->pc);
+    ref_op d = ref_ops[op];
+    u8 lo = d.length > 1 ? ref_read(c, c->pc + 1) : 0;
+    u8 hi = d.length > 2 ? ref_read(c, c->pc + 2) : 0;
+    u16 imm = hi << 8 | lo;
+    u16 next = c->pc + d.length;
+    int dst = (op >> 3) & 7;
+    int src = op & 7;
+    int rp = (op >> 4) & 3;
+    int taken = 0;
+
+    c->cycles += d.cycles;
+    switch (d.kind) {
+        case K_NOP: break;
+        case K_LXI: ref_set_rp(c, rp, imm); break;
+        case K_STAX: ref_write(c, ref_get_rp(c, rp), c->reg[REG_A]); break;
+        case K_LDAX: c->reg[REG_A] = ref_read(c, ref_get_rp(c, rp)); break;
+        case K_SHLD: ref_write(c, imm, c->reg[5]); ref_write(c, imm + 1, c->reg[4]); break;
+        case K_LHLD: c->reg[5] = ref_read(c, imm); c->reg[4] = ref_read(c, imm + 1); break;
+        case K_STA: ref_write(c, imm, c->reg[REG_A]); break;
+        case K_LDA: c->reg[REG_A] = ref_read(c, imm); break;
+        case K_INX: ref_set_rp(c, rp, ref_get_rp(c, rp) + 1); break;
+        case K_DCX: ref_set_rp(c, rp, ref_get_rp(c, rp) - 1); break;
+        case K_INR: {
+            u8 val = ref_get(c, dst) + 1;
+            ref_set(c, dst, val);
+            ref_set_flags(c, ref_zsp(val) | ((val & 0xf) == 0 ? F_AC : 0) | (c->f & F_CY));
+        } break;
+        case K_DCR: {
+            u8 val = ref_get(c, dst) - 1;
+            ref_set(c, dst, val);
+            ref_set_flags(c, ref_zsp(val) | ((val & 0xf) != 0xf ? F_AC : 0) | (c->f & F_CY));
+        } break;
+        case K_MVI: ref_set(c, dst, lo); break;
+        case K_DAD: {
+            u32 sum = ref_get_rp(c, 2) + ref_get_rp(c, rp);
+            ref_set_rp(c, 2, sum);
+            c->f = (c->f & ~F_CY) | (sum > 0xffff ? F_CY : 0);
+        } break;
+        case K_RLC: {
+            u8 a = c->reg[REG_A];
+            c->reg[REG_A] = a << 1 | a >> 7;
+            c->f = (c->f & ~F_CY) | (a >> 7);
+        } break;
+        case K_RRC: {
+            u8 a = c->reg[REG_A];
+            c->reg[REG_A] = a >> 1 | a << 7;
+            c->f = (c->f & ~F_CY) | (a & 1);
+        } break;
+        case K_RAL: {
+            u8 a = c->reg[REG_A];
+            c->reg[REG_A] = a << 1 | (c->f & F_CY);
+            c->f = (c->f & ~F_CY) | (a >> 7);
+        } break;
+        case K_RAR: {
+            u8 a = c->reg[REG_A];
+            c->reg[REG_A] = a >> 1 | (c->f & F_CY) << 7;
+            c->f = (c->f & ~F_CY) | (a & 1);
+        } break;
+        case K_DAA: ref_daa(c); break;
+        case K_CMA: c->reg[REG_A] = ~c->reg[REG_A]; break;
+        case K_STC: c->f |= F_CY; break;
+        case K_CMC: c->f ^= F_CY; break;
+        case K_MOV: ref_set(c, dst, ref_get(c, src)); break;
+        case K_HLT: c->halted = 1; c->steps++; return 0;
+        case K_ALU: ref_alu(c, dst, ref_get(c, src)); break;
+        case K_ALUI: ref_alu(c, dst, lo); break;
+        case K_RCC: if (ref_cond(c, dst)) { next = ref_pop(c); taken = 1; } break;
+        case K_RET: next = ref_pop(c); break;
+        case K_POP: {
+            u16 val = ref_pop(c);
+            if (rp == 3) {
+                ref_set_flags(c, val & 0xff);
+                c->reg[REG_A] = val >> 8;
+            } else {
+                ref_set_rp(c, rp, val);
+            }
+        } break;
+        case K_JCC: if (ref_cond(c, dst)) next = imm; break;
+        case K_JMP: next = imm; break;
+        case K_CCC: if (ref_cond(c, dst)) { ref_push(c, next); next = imm; taken = 1; } break;
+        case K_CALL: ref_push(c, next); next = imm; break;
+        case K_PUSH: ref_push(c, rp == 3 ? (c->reg[REG_A] << 8 | c->f) : ref_get_rp(c, rp)); break;
+        case K_RST: ref_push(c, next); next = dst * 8; break;
+        case K_OUT: c->outPort = lo; c->outValue = c->reg[REG_A]; c->outCount++; break;
+        case K_IN: c->reg[REG_A] = fuzz_in_value(c->salt, lo, c->steps); break;
+        case K_XTHL: {
+            u8 l = ref_read(c, c->sp);
+            u8 h = ref_read(c, c->sp + 1);
+            ref_write(c, c->sp, c->reg[5]);
+            ref_write(c, c->sp + 1, c->reg[4]);
+            c->reg[5] = l;
+            c->reg[4] = h;
+        } break;
+        case K_PCHL: next = ref_hl(c); break;
+        case K_XCHG: {
+            u16 de = ref_get_rp(c, 1);
+            ref_set_rp(c, 1, ref_hl(c));
+            ref_set_rp(c, 2, de);
+        } break;
+        case K_SPHL: c->sp = ref_hl(c); break;
+        case K_DI: c->ie = 0; break;
+        case K_EI: c->ie = 1; break;
+    }
+    if (taken) c->cycles += d.cyclesTaken - d.cycles;
+    c->pc = next;
+    c->steps++;
+    return 1;
+}
+
+//
+// Core side
+//
+
+enum fuzz_engine {
+    ENGINE_TIMED,   // emulate_8080 with countCycles and nothing attached
+    ENGINE_HOOKED,  // emulate_8080 with empty traps, a recording log and sometimes a state hash
+    ENGINE_FLAT,    // emulate_8080 with nothing attached, doesn't count cycles
+    ENGINE_TRAPPED, // emulate_8080 with only watchpoints, doesn't count cycles
+    ENGINE_COUNT,
+};
+
+static const char *engine_names[ENGINE_COUNT] = { "timed", "hooked", "flat", "trapped" };
+
+typedef struct fuzz_core {
+    cpu_8080 cpu;
+    traps_8080 *noTraps;
+    traps_8080 *watchTraps;
+    io_log log;
+    state_hash_8080 hash;
+    u64 salt;
+    u8 outPort, outValue, outCount;
+} fuzz_core;
+
+static u8
+fuzz_in(cpu_8080 *cpu, u8 port)
+{
+    fuzz_core *core = cpu->userData;
+    return fuzz_in_value(core->salt, port, cpu->steps);
+}
+
+static void
+fuzz_out(cpu_8080 *cpu, u8 port, u8 val)
+{
+    fuzz_core *core = cpu->userData;
+    core->outPort = port;
+    core->outValue = val;
+    core->outCount++;
+}
+
+static u8
+core_flags(cpu_8080 *cpu)
+{
+    return cpu->cc.s << 7 | cpu->cc.z << 6 | cpu->cc.ac << 4 | cpu->cc.p << 2 | 0x02 | cpu->cc.cy;
+}
+
+static int
+same_state(fuzz_core *core, ref_cpu *ref, int engine)
+{
+    cpu_8080 *cpu = &core->cpu;
+    if (cpu->b != ref->reg[0] || cpu->c != ref->reg[1] || cpu->d != ref->reg[2] || cpu->e != ref->reg[3] ||
+        cpu->h != ref->reg[4] || cpu->l != ref->reg[5] || cpu->a != ref->reg[REG_A]) return 0;
+    if (cpu->sp != ref->sp || cpu->pc != ref->pc || core_flags(cpu) != ref->f) return 0;
+    if (cpu->interruptEnabled != ref->ie || cpu->halted != ref->halted || cpu->steps != ref->steps) return 0;
+    if (engine != ENGINE_FLAT && engine != ENGINE_TRAPPED && cpu->cycles != ref->cycles) return 0;
+    if (core->outCount != ref->outCount || core->outPort != ref->outPort || core->outValue != ref->outValue) return 0;
+    for (int i = 0; i < ref->writeCount; ++i) {
+        u16 addr = ref->writes[i];
+        if (cpu->m[addr] != ref->m[addr]) return 0;
+    }
+    return 1;
+}
+
+//
+// Cases
+//
+
+typedef struct fuzz_rng {
+    u64 state;
+} fuzz_rng;
+
+static u64
+rng_next(fuzz_rng *rng)
+{
+    rng->state += 0x9e3779b97f4a7c15ull;
+    return mix64(rng->state);
+}
+
+// Memory every case starts from, before its own code and state are added.
+static u8 *background;
+
+// Register values that tend to hit flag edge cases.
+static const u8 interesting[] = { 0x00, 0x01, 0x0f, 0x10, 0x7f, 0x80, 0x99, 0x9a, 0xf0, 0xff };
+
+static void
+case_init(u64 seed, fuzz_rng *rng, ref_cpu *ref, u8 *refMem)
+{
+    rng->state = seed;
+    memcpy(refMem, background, MEM_SIZE);
+
+    *ref = (ref_cpu){0};
+    ref->m = refMem;
+    for (int r = 0; r < 8; ++r) {
+        u64 x = rng_next(rng);
+        ref->reg[r] = (x & 3) == 0 ? interesting[(x >> 8) % sizeof(interesting)] : (x >> 16) & 0xff;
+    }
+    ref->reg[REG_M] = 0;
+    u64 x = rng_next(rng);
+    ref_set_flags(ref, x & 0xff);
+    ref->sp = x >> 8;
+    ref->pc = x >> 24;
+    ref->ie = (x >> 40) & 1;
+    ref->salt = rng_next(rng);
+
+    for (int i = 0; i < CASE_STEPS * 3; i += 8) {
+        x = rng_next(rng);
+        for (int j = 0; j < 8; ++j) refMem[(u16)(ref->pc + i + j)] = x >> (j * 8);
+    }
+}
+
+// Copies the reference state into the core.
+// A watchpoint at the start of every page makes every access take the trap check.
+// emulate_8080 doesn't stop for them, so the results stay the same.
+static void
+core_traps_alloc(fuzz_core *core)
+{
+    core->noTraps = calloc(1, sizeof(traps_8080));
+    core->watchTraps = calloc(1, sizeof(traps_8080));
+    for (int page = 0; page < 0x100; ++page) traps_set(core->watchTraps, (u16)(page << 8), TRAP_READ | TRAP_WRITE);
+}
+
+static void
+core_traps_free(fuzz_core *core)
+{
+    free(core->noTraps);
+    free(core->watchTraps);
+}
+
+static void
+core_load(fuzz_core *core, ref_cpu *ref, u8 *coreMem, int engine)
+{
+    cpu_8080 *cpu = &core->cpu;
+    memcpy(coreMem, ref->m, MEM_SIZE);
+
+    *cpu = (cpu_8080){0};
+    cpu->m = coreMem;
+    cpu->b = ref->reg[0];
+    cpu->c = ref->reg[1];
+    cpu->d = ref->reg[2];
+    cpu->e = ref->reg[3];
+    cpu->h = ref->reg[4];
+    cpu->l = ref->reg[5];
+    cpu->a = ref->reg[REG_A];
+    cpu->sp = ref->sp;
+    cpu->pc = ref->pc;
+    cpu->cc.s = (ref->f & F_S) != 0;
+    cpu->cc.z = (ref->f & F_Z) != 0;
+    cpu->cc.ac = (ref->f & F_AC) != 0;
+    cpu->cc.p = (ref->f & F_P) != 0;
+    cpu->cc.cy = (ref->f & F_CY) != 0;
+    cpu->interruptEnabled = ref->ie;
+    cpu->halted = ref->halted;
+    cpu->steps = ref->steps;
+    cpu->cycles = ref->cycles;
+    cpu->in = fuzz_in;
+    cpu->out = fuzz_out;
+    cpu->userData = core;
+
+    core->salt = ref->salt;
+    core->outPort = ref->outPort;
+    core->outValue = ref->outValue;
+    core->outCount = ref->outCount;
+    if (engine == ENGINE_TIMED) cpu->countCycles = 1;
+    if (engine == ENGINE_HOOKED) {
+        cpu->traps = core->noTraps;
+        io_log_record(cpu, &core->log, NULL);
+        // Hashing all of memory costs more than the case itself, only do it in
+        // some of them. Picked by the salt so a reproducer does the same.
+        if ((ref->salt & 15) == 0) state_hash_attach(cpu, &core->hash, MEM_SIZE);
+    }
+    if (engine == ENGINE_TRAPPED) cpu->traps = core->watchTraps;
+}
+
+// The incrementally updated hash matches hashing memory from scratch.
+static int
+core_hash_ok(fuzz_core *core)
+{
+    cpu_8080 *cpu = &core->cpu;
+    if (!cpu->hash) return 1;
+    state_hash_8080 incremental = core->hash;
+    state_hash_reset(cpu);
+    return memcmp(&incremental, &core->hash, sizeof(incremental)) == 0;
+}
+
+static void
+core_unload(fuzz_core *core)
+{
+    if (core->cpu.log) io_log_close(&core->cpu, &core->log);
+}
+
+// Interrupt to raise before a step, or -1. Drawn from the case rng so replaying a
+// seed raises the same ones.
+static int
+case_interrupt(fuzz_rng *rng)
+{
+    u64 x = rng_next(rng);
+    return (x & 31) == 0 ? (int)((x >> 8) & 7) : -1;
+}
+
+// One step of both models. Returns 0 when they disagree.
+static int
+fuzz_step(fuzz_core *core, ref_cpu *ref, int engine, int interrupt, int *running)
+{
+    ref->readCount = 0;
+    ref->writeCount = 0;
+    if (interrupt >= 0) {
+        if (interrupt_8080(&core->cpu, interrupt) != ref_interrupt(ref, interrupt)) return 0;
+    }
+    int refRunning = ref_step(ref);
+    int coreRunning = emulate_8080(&core->cpu);
+    // A halted cpu with interrupts enabled keeps going until one wakes it.
+    *running = refRunning || ref->ie;
+    return refRunning == coreRunning && same_state(core, ref, engine);
+}
+
+typedef struct fuzz_failure {
+    u64 seed;
+    int engine;
+    int step;   // first step that disagreed
+} fuzz_failure;
+
+// Runs a whole case. Returns the number of instructions executed, and fills in
+// failure->step (else -1).
+static int
+run_case(u64 seed, int engine, fuzz_core *core, u8 *coreMem, u8 *refMem, fuzz_failure *failure)
+{
+    fuzz_rng rng;
+    ref_cpu ref;
+    case_init(seed, &rng, &ref, refMem);
+    core_load(core, &ref, coreMem, engine);
+
+    failure->seed = seed;
+    failure->engine = engine;
+    failure->step = -1;
+
+    int step = 0;
+    int running = 1;
+    int memoryChecked = 0;
+    for (; step < CASE_STEPS && running; ++step) {
+        if (!fuzz_step(core, &ref, engine, case_interrupt(&rng), &running)) {
+            failure->step = step;
+            break;
+        }
+    }
+    if (failure->step < 0 && (memcmp(coreMem, refMem, MEM_SIZE) != 0 || !core_hash_ok(core))) memoryChecked = 1;
+    core_unload(core);
+
+    if (memoryChecked) {
+        // A store went somewhere the reference didn't write, or wasn't hashed.
+        // Replay the case comparing all of memory after every step to find it.
+        case_init(seed, &rng, &ref, refMem);
+        core_load(core, &ref, coreMem, engine);
+        running = 1;
+        for (int i = 0; i < step && running; ++i) {
+            if (!fuzz_step(core, &ref, engine, case_interrupt(&rng), &running) ||
+                memcmp(coreMem, refMem, MEM_SIZE) != 0 || !core_hash_ok(core)) {
+                failure->step = i;
+                break;
+            }
+        }
+        core_unload(core);
+    }
+    return step;
+}
+
+//
+// Shrinking
+//
+
+// Machine state right before the failing step, with the interrupt raised there.
+typedef struct repro {
+    ref_cpu state;
+    u8 *m;
+    int interrupt;
+    int engine;
+} repro;
+
+typedef struct repro_result {
+    ref_cpu ref;
+    fuzz_core core;
+    int refRunning;
+    int coreRunning;
+    int interruptRef;
+    int interruptCore;
+    int hashOk;
+} repro_result;
+
+static u8 *shrinkCoreMem;
+static u8 *shrinkRefMem;
+
+static int
+repro_run(repro *r, repro_result *out)
+{
+    memset(&out->core, 0, sizeof(out->core));
+    core_traps_alloc(&out->core);
+    out->ref = r->state;
+    out->ref.m = shrinkRefMem;
+    memcpy(shrinkRefMem, r->m, MEM_SIZE);
+    core_load(&out->core, &out->ref, shrinkCoreMem, r->engine);
+
+    out->ref.readCount = 0;
+    out->ref.writeCount = 0;
+    out->interruptRef = out->interruptCore = 0;
+    if (r->interrupt >= 0) {
+        out->interruptCore = interrupt_8080(&out->core.cpu, r->interrupt);
+        out->interruptRef = ref_interrupt(&out->ref, r->interrupt);
+    }
+    out->refRunning = ref_step(&out->ref);
+    out->coreRunning = emulate_8080(&out->core.cpu);
+
+    out->hashOk = core_hash_ok(&out->core);
+    int same = out->interruptRef == out->interruptCore && out->refRunning == out->coreRunning &&
+               same_state(&out->core, &out->ref, r->engine) && memcmp(shrinkCoreMem, shrinkRefMem, MEM_SIZE) == 0 &&
+               out->hashOk;
+    core_unload(&out->core);
+    core_traps_free(&out->core);
+    return !same;
+}
+
+static int
+repro_fails(repro *r)
+{
+    repro_result result;
+    return repro_run(r, &result);
+}
+
+static void
+shrink(fuzz_failure *failure, repro *r)
+{
+    // Replay the reference up to the failing step.
+    fuzz_rng rng;
+    ref_cpu ref;
+    u8 *mem = malloc(MEM_SIZE);
+    case_init(failure->seed, &rng, &ref, mem);
+    int interrupt = case_interrupt(&rng);
+    for (int i = 0; i < failure->step; ++i) {
+        ref.readCount = ref.writeCount = 0;
+        if (interrupt >= 0) ref_interrupt(&ref, interrupt);
+        ref_step(&ref);
+        interrupt = case_interrupt(&rng);
+    }
+
+    r->state = ref;
+    r->m = mem;
+    r->interrupt = interrupt;
+    r->engine = failure->engine;
+    if (!repro_fails(r)) return; // depends on more than one step, keep it whole
+
+    // Only keep the bytes the reference touched in that step.
+    repro_result result;
+    repro_run(r, &result);
+    u8 *small = calloc(1, MEM_SIZE);
+    for (int i = 0; i < result.ref.readCount; ++i) small[result.ref.reads[i]] = mem[result.ref.reads[i]];
+    for (int i = 0; i < result.ref.writeCount; ++i) small[result.ref.writes[i]] = mem[result.ref.writes[i]];
+    r->m = small;
+    if (!repro_fails(r)) {
+        r->m = mem;
+        free(small);
+        return;
+    }
+    free(mem);
+
+    // Then zero whatever else still fails without it.
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int reg = 0; reg < 8; ++reg) {
+            u8 old = r->state.reg[reg];
+            if (reg == REG_M || old == 0) continue;
+            r->state.reg[reg] = 0;
+            if (repro_fails(r)) changed = 1;
+            else r->state.reg[reg] = old;
+        }
+        for (u8 bit = 1; bit; bit <<= 1) {
+            if (!(r->state.f & bit & F_MASK)) continue;
+            r->state.f &= ~bit;
+            if (repro_fails(r)) changed = 1;
+            else r->state.f |= bit;
+        }
+        if (r->interrupt < 0 && r->state.ie) {
+            r->state.ie = 0;
+            if (repro_fails(r)) changed = 1;
+            else r->state.ie = 1;
+        }
+        for (int addr = 0; addr < MEM_SIZE; ++addr) {
+            u8 old = r->m[addr];
+            if (!old || addr == r->state.pc) continue;
+            r->m[addr] = 0;
+            if (repro_fails(r)) changed = 1;
+            else r->m[addr] = old;
+        }
+    }
+}
+
+static void
+print_ref_state(const char *name, ref_cpu *c)
+{
+    printf("  %-10s A=%02x B=%02x C=%02x D=%02x E=%02x H=%02x L=%02x SP=%04x PC=%04x F=%02x IE=%u HALT=%u cycles=%llu\n",
+           name, c->reg[REG_A], c->reg[0], c->reg[1], c->reg[2], c->reg[3], c->reg[4], c->reg[5], c->sp, c->pc,
+           c->f, c->ie, c->halted, (unsigned long long)c->cycles);
+}
+
+static void
+print_repro(fuzz_failure *failure, repro *r)
+{
+    printf("FAIL: engine %s, seed 0x%016llx, step %d\n", engine_names[failure->engine],
+           (unsigned long long)failure->seed, failure->step);
+    printf("state before the failing instruction:\n");
+    print_ref_state("", &r->state);
+    printf("  steps=%llu salt=0x%016llx\n", (unsigned long long)r->state.steps, (unsigned long long)r->state.salt);
+    if (r->interrupt >= 0) printf("  interrupt %d raised first\n", r->interrupt);
+    printf("  memory:");
+    int nonzero = 0;
+    for (int addr = 0; addr < MEM_SIZE; ++addr) {
+        if (r->m[addr] && nonzero++ < 32) printf(" [%04x]=%02x", addr, r->m[addr]);
+    }
+    if (nonzero > 32) printf(" ... (%d nonzero bytes)", nonzero);
+    printf("\n  instruction: %02x\n", r->m[r->state.pc]);
+
+    repro_result result;
+    repro_run(r, &result);
+    cpu_8080 *cpu = &result.core.cpu;
+    ref_cpu core = {0};
+    core.reg[0] = cpu->b;
+    core.reg[1] = cpu->c;
+    core.reg[2] = cpu->d;
+    core.reg[3] = cpu->e;
+    core.reg[4] = cpu->h;
+    core.reg[5] = cpu->l;
+    core.reg[REG_A] = cpu->a;
+    core.sp = cpu->sp;
+    core.pc = cpu->pc;
+    core.f = core_flags(cpu);
+    core.ie = cpu->interruptEnabled;
+    core.halted = cpu->halted;
+    core.cycles = cpu->cycles;
+    printf("after it:\n");
+    print_ref_state("reference", &result.ref);
+    print_ref_state("core", &core);
+    if (result.refRunning != result.coreRunning) {
+        printf("  halted: reference %d, core %d\n", !result.refRunning, !result.coreRunning);
+    }
+    if (result.interruptRef != result.interruptCore) {
+        printf("  interrupt taken: reference %d, core %d\n", result.interruptRef, result.interruptCore);
+    }
+    if (result.core.outCount != result.ref.outCount || result.core.outValue != result.ref.outValue) {
+        printf("  OUT: reference %02x <- %02x (%u), core %02x <- %02x (%u)\n", result.ref.outPort,
+               result.ref.outValue, result.ref.outCount, result.core.outPort, result.core.outValue,
+               result.core.outCount);
+    }
+    for (int addr = 0; addr < MEM_SIZE; ++addr) {
+        if (shrinkCoreMem[addr] != shrinkRefMem[addr]) {
+            printf("  memory [%04x]: reference %02x, core %02x\n", addr, shrinkRefMem[addr], shrinkCoreMem[addr]);
+        }
+    }
+    if (!result.hashOk) printf("  state hash doesn't match hashing memory from scratch\n");
+}
+
+//
+// Driver
+//
+
+typedef struct fuzz_shared {
+    u64 nextSeed;
+    u64 lastSeed;   // exclusive, 0 for no limit
+    double deadline;
+    int stop;
+    pthread_mutex_t lock;
+    int failed;
+    fuzz_failure failure;
+    u64 instructions;
+    u64 cases;
+} fuzz_shared;
+
+static double
+seconds_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *
+fuzz_thread(void *arg)
+{
+    fuzz_shared *shared = arg;
+    fuzz_core core = {0};
+    core_traps_alloc(&core);
+    u8 *coreMem = malloc(MEM_SIZE);
+    u8 *refMem = malloc(MEM_SIZE);
+    u64 instructions = 0;
+    u64 cases = 0;
+
+    while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+        if (seconds_now() > shared->deadline) break;
+        u64 seed = __atomic_fetch_add(&shared->nextSeed, 1, __ATOMIC_RELAXED);
+        if (shared->lastSeed && seed >= shared->lastSeed) break;
+
+        fuzz_failure failure;
+        instructions += run_case(seed, seed % ENGINE_COUNT, &core, coreMem, refMem, &failure);
+        cases++;
+        if (failure.step >= 0) {
+            pthread_mutex_lock(&shared->lock);
+            if (!shared->failed || seed < shared->failure.seed) shared->failure = failure;
+            shared->failed = 1;
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&shared->lock);
+        }
+    }
+
+    pthread_mutex_lock(&shared->lock);
+    shared->instructions += instructions;
+    shared->cases += cases;
+    pthread_mutex_unlock(&shared->lock);
+    core_traps_free(&core);
+    free(coreMem);
+    free(refMem);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = 10;
+    u64 cases = 0;
+    u64 seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:n:s:")) != -1) {
+        switch (opt) {
+            case 'j': threads = atoi(optarg); break;
+            case 't': seconds = atof(optarg); break;
+            case 'n': cases = strtoull(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-j threads] [-t seconds] [-n cases] [-s first seed]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (threads < 1) threads = 1;
+
+    ref_init_ops();
+    background = malloc(MEM_SIZE);
+    fuzz_rng rng = { 0x8080 };
+    for (int i = 0; i < MEM_SIZE; i += 8) {
+        u64 x = rng_next(&rng);
+        memcpy(background + i, &x, 8);
+    }
+
+    fuzz_shared shared = {0};
+    shared.nextSeed = seed;
+    shared.lastSeed = cases ? seed + cases : 0;
+    double start = seconds_now();
+    shared.deadline = start + seconds;
+    pthread_mutex_init(&shared.lock, NULL);
+
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; ++i) pthread_create(&ids[i], NULL, fuzz_thread, &shared);
+    for (int i = 0; i < threads; ++i) pthread_join(ids[i], NULL);
+    double elapsed = seconds_now() - start;
+
+    printf("%llu cases, %llu instructions in %.1fs on %d threads (%.1f M instructions/s)\n",
+           (unsigned long long)shared.cases, (unsigned long long)shared.instructions, elapsed, threads,
+           shared.instructions / elapsed / 1e6);
+
+    if (shared.failed) {
+        shrinkCoreMem = malloc(MEM_SIZE);
+        shrinkRefMem = malloc(MEM_SIZE);
+        repro r;
+        shrink(&shared.failure, &r);
+        print_repro(&shared.failure, &r);
+        return 1;
+    }
+    return 0;
+}
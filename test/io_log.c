@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <string.h>
+#include "../c8080.c"
+
+// Record/replay through a log file. Build with `gcc io_log.c -o io_log`, it prints
+// the failed checks and exits with 1 if there are any. It writes its logs to the
+// current directory and removes them again.
+//
+// The guest adds up IN 1 values in C and counts RST 1 interrupts at 0x3000. The
+// host raises RST 1 every 37 steps.
+//
+//   0x008 PUSH PSW / LDA 0x3000 / INR A / STA 0x3000 / POP PSW / EI / RET
+//
+//   0x100 LXI SP,0x3f00
+//         EI
+//   loop:
+//   0x104 IN 1 / ADD C / MOV C,A
+//         JMP loop
+static const u8 handler[] = { 0xf5, 0x3a, 0x00, 0x30, 0x3c, 0x32, 0x00, 0x30, 0xf1, 0xfb, 0xc9 };
+static const u8 program[] = { 0x31, 0x00, 0x3f, 0xfb, 0xdb, 0x01, 0x81, 0x4f, 0xc3, 0x04, 0x01 };
+
+#define MEM_SIZE 0x4000
+#define RUN_STEPS 20000
+#define LOG_PATH "io_log_test.log"
+#define CUT_PATH "io_log_test_cut.log"
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+static u32 reads;
+
+static u8
+device_in(cpu_8080 *cpu, u8 port)
+{
+    return (u8)((reads++ * 0x9d) ^ port);
+}
+
+// A replaying machine has no devices, only the log.
+static void
+machine_init(cpu_8080 *cpu, int devices)
+{
+    u8 *m = cpu->m ? cpu->m : malloc(0x10000);
+    memset(cpu, 0, sizeof(*cpu));
+    memset(m, 0, 0x10000);
+    memcpy(m + 0x08, handler, sizeof(handler));
+    memcpy(m + 0x100, program, sizeof(program));
+    cpu->m = m;
+    cpu->pc = 0x100;
+    cpu->in = devices ? device_in : NULL;
+    reads = 0;
+}
+
+// Steps to step, raising RST 1 every 37 steps. Returns 0 if emulate_8080 did.
+static int
+host_run(cpu_8080 *cpu, u64 step)
+{
+    while (cpu->steps < step) {
+        if (cpu->steps % 37 == 0) interrupt_8080(cpu, 1);
+        if (!emulate_8080(cpu)) return 0;
+    }
+    return 1;
+}
+
+static int
+same_state(cpu_8080 *a, cpu_8080 *b)
+{
+    return memcmp(a->r, b->r, sizeof(a->r)) == 0 && a->sp == b->sp && a->pc == b->pc &&
+           memcmp(&a->cc, &b->cc, sizeof(a->cc)) == 0 && a->interruptEnabled == b->interruptEnabled && a->halted == b->halted &&
+           a->steps == b->steps && memcmp(a->m, b->m, MEM_SIZE) == 0;
+}
+
+// log holds the first events of full.
+static int
+same_events(io_log *log, io_log *full)
+{
+    for (size_t i = 0; i < log->count; ++i) {
+        io_event *a = &log->events[i], *b = &full->events[i];
+        if (a->step != b->step || a->kind != b->kind || a->port != b->port || a->value != b->value) return 0;
+    }
+    return 1;
+}
+
+static long
+file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+// What a crash leaves behind: the first size bytes of what is on disk.
+static void
+copy_prefix(const char *from, const char *to, long size)
+{
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    for (long i = 0; i < size; ++i) {
+        int c = fgetc(in);
+        if (c == EOF) break;
+        fputc(c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+// Records RUN_STEPS steps into LOG_PATH and leaves the final state in rec.
+static void
+record(cpu_8080 *rec, io_log *full)
+{
+    io_log log;
+    machine_init(rec, 1);
+    CHECK(io_log_record(rec, &log, LOG_PATH));
+    host_run(rec, RUN_STEPS / 2);
+
+    // Still recording, but most of it has to be on disk already.
+    copy_prefix(LOG_PATH, CUT_PATH, file_size(LOG_PATH));
+    io_log early;
+    cpu_8080 replay = { .m = malloc(0x10000) };
+    machine_init(&replay, 0);
+    CHECK(io_log_replay(&replay, &early, CUT_PATH));
+    CHECK(early.count + IO_LOG_FLUSH_INTERVAL >= log.count);
+    io_log_close(&replay, &early);
+    free(replay.m);
+
+    host_run(rec, RUN_STEPS);
+    *full = log;
+    full->file = NULL;
+    full->events = malloc(log.count * sizeof(io_event));
+    memcpy(full->events, log.events, log.count * sizeof(io_event));
+    io_log_close(rec, &log);
+}
+
+static void
+test_replay(cpu_8080 *rec, io_log *full)
+{
+    cpu_8080 cpu = { .m = malloc(0x10000) };
+    io_log log;
+    machine_init(&cpu, 0);
+    CHECK(io_log_replay(&cpu, &log, LOG_PATH));
+    CHECK(!log.truncated && log.count == full->count);
+
+    CHECK(host_run(&cpu, RUN_STEPS));
+    CHECK(!log.desync && log.cursor == log.count);
+    CHECK(same_state(&cpu, rec));
+
+    // Past the end of the log the next IN desyncs, and stops before it changes A.
+    u8 a;
+    do {
+        a = cpu.a;
+    } while (emulate_8080(&cpu));
+    CHECK(log.desync && cpu.m[cpu.pc] == 0xdb && cpu.a == a);
+    io_log_close(&cpu, &log);
+    free(cpu.m);
+}
+
+// Every cut through the last records keeps exactly the records before the cut.
+static void
+test_truncated(io_log *full)
+{
+    cpu_8080 cpu = { .m = malloc(0x10000) };
+    long size = file_size(LOG_PATH);
+    size_t prevCount = 0;
+    for (long cut = size - 32; cut < size; ++cut) {
+        io_log log;
+        copy_prefix(LOG_PATH, CUT_PATH, cut);
+        machine_init(&cpu, 0);
+        CHECK(io_log_replay(&cpu, &log, CUT_PATH));
+        CHECK(log.count < full->count && log.count >= prevCount);
+        CHECK(log.truncated || log.count > prevCount);
+        CHECK(same_events(&log, full));
+        prevCount = log.count;
+        io_log_close(&cpu, &log);
+    }
+    CHECK(prevCount == full->count - 1);
+
+    // Replay runs the same up to the lost record.
+    cpu_8080 ref = { .m = malloc(0x10000) };
+    io_log refLog, log;
+    machine_init(&ref, 0);
+    machine_init(&cpu, 0);
+    CHECK(io_log_replay(&ref, &refLog, LOG_PATH));
+    CHECK(io_log_replay(&cpu, &log, CUT_PATH));
+    u64 lost = full->events[full->count - 1].step;
+    CHECK(host_run(&ref, lost));
+    CHECK(host_run(&cpu, lost));
+    CHECK(same_state(&cpu, &ref));
+    io_log_close(&ref, &refLog);
+    io_log_close(&cpu, &log);
+    free(ref.m);
+    free(cpu.m);
+}
+
+// EI / HLT / MVI A,42h / HLT, woken by an interrupt while it waits in the first
+// HLT. The interrupt returns past the HLT, and replays at the same point.
+static void
+run_halt(cpu_8080 *cpu)
+{
+    while (cpu->steps < 30) {
+        if (cpu->steps == 6) interrupt_8080(cpu, 1);
+        emulate_8080(cpu);
+    }
+}
+
+static void
+test_halt(void)
+{
+    static const u8 halts[] = { 0x31, 0x00, 0x3f, 0xfb, 0x76, 0x3e, 0x42, 0x76 };
+    cpu_8080 rec = {0}, cpu = {0};
+    io_log recLog, log;
+    machine_init(&rec, 1);
+    memcpy(rec.m + 0x100, halts, sizeof(halts));
+    CHECK(io_log_record(&rec, &recLog, LOG_PATH));
+    run_halt(&rec);
+    io_log_close(&rec, &recLog);
+    CHECK(rec.halted && rec.pc == 0x107 && rec.a == 0x42 && rec.m[0x3000] == 1);
+
+    machine_init(&cpu, 0);
+    memcpy(cpu.m + 0x100, halts, sizeof(halts));
+    CHECK(io_log_replay(&cpu, &log, LOG_PATH));
+    run_halt(&cpu);
+    CHECK(!log.desync && same_state(&cpu, &rec));
+    io_log_close(&cpu, &log);
+    free(rec.m);
+    free(cpu.m);
+}
+
+int main(void)
+{
+    cpu_8080 rec = {0};
+    io_log full;
+
+    record(&rec, &full);
+    test_replay(&rec, &full);
+    test_truncated(&full);
+    test_halt();
+
+    remove(LOG_PATH);
+    remove(CUT_PATH);
+    printf(failures ? "io_log: %d checks failed\n" : "io_log: ok\n", failures);
+    return failures ? 1 : 0;
+}
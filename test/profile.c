@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../c8080.c"
+#include "../c8080_profile.c"
+
+// Folded stacks of the sampling profiler. Build with `gcc profile.c -o profile`,
+// it prints the failed checks and exits with 1 if there are any. It needs a few
+// hundred samples, which takes about a second of cpu time.
+//
+// The guest calls through two levels, so every sample has one of a few stacks:
+//
+//   0x100 LXI SP,0x3f00
+//   loop:
+//   0x103 CALL 0x200
+//   0x106 JMP loop
+//
+//   0x200 CALL 0x300 / RST 2 / RET
+//
+//   0x300 MVI B,0        (512 steps)
+//   0x302 DCR B / JNZ 0x302
+//   0x306 RET
+//
+//   0x010 MVI C,40h      (128 steps)
+//   0x012 DCR C / JNZ 0x012
+//   0x016 RET
+static const u8 program[] = { 0x31, 0x00, 0x3f, 0xcd, 0x00, 0x02, 0xc3, 0x03, 0x01 };
+static const u8 outer[] = { 0xcd, 0x00, 0x03, 0xd7, 0xc9 };
+static const u8 inner[] = { 0x06, 0x00, 0x05, 0xc2, 0x02, 0x03, 0xc9 };
+static const u8 rst2[] = { 0x0e, 0x40, 0x0d, 0xc2, 0x12, 0x00, 0xc9 };
+
+#define MEM_SIZE 0x4000
+#define MIN_SAMPLES 300
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+static void
+reset(cpu_8080 *cpu)
+{
+    u8 *m = cpu->m;
+    memset(cpu, 0, sizeof(*cpu));
+    memset(m, 0, 0x10000);
+    memcpy(m + 0x100, program, sizeof(program));
+    memcpy(m + 0x200, outer, sizeof(outer));
+    memcpy(m + 0x300, inner, sizeof(inner));
+    memcpy(m + 0x10, rst2, sizeof(rst2));
+    cpu->m = m;
+    cpu->pc = 0x100;
+}
+
+// Every stack the guest can have, and where the sampled pc is when it is in the
+// innermost function. A signal in the middle of a CALL or RET can see the frame
+// pushed and the pc not moved yet, or the other way around, so a few samples
+// don't match their stack.
+static const struct {
+    const char *frames;
+    u16 start, end;
+} stacks[] = {
+    { "", 0x100, 0x108 },
+    { "sub_0200;", 0x200, 0x204 },
+    { "sub_0200;sub_0300;", 0x300, 0x306 },
+    { "sub_0200;sub_0010;", 0x010, 0x016 },
+};
+#define STACK_COUNT (sizeof(stacks) / sizeof(stacks[0]))
+
+// Reads the folded output back into samples per stack. Returns the total.
+static u64
+read_folded(FILE *f, u64 counts[STACK_COUNT], u64 *matching, u64 *dropped)
+{
+    char line[256];
+    u64 total = 0;
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        unsigned pc;
+        unsigned long long count;
+        char *leaf = strrchr(line, ';');
+        leaf = leaf ? leaf + 1 : line;
+        if (sscanf(line, "[dropped] %llu", &count) == 1) {
+            *dropped = count;
+            continue;
+        }
+        if (sscanf(leaf, "0x%x %llu", &pc, &count) != 2) {
+            printf("bad line: %s", line);
+            failures++;
+            continue;
+        }
+
+        size_t frameLength = leaf - line;
+        size_t i = 0;
+        while (i < STACK_COUNT && (strlen(stacks[i].frames) != frameLength || strncmp(line, stacks[i].frames, frameLength) != 0)) ++i;
+        if (i == STACK_COUNT) {
+            printf("unexpected stack: %s", line);
+            failures++;
+            continue;
+        }
+        counts[i] += count;
+        if (pc >= stacks[i].start && pc <= stacks[i].end) *matching += count;
+        total += count;
+    }
+    return total;
+}
+
+static double
+seconds_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void
+test_stacks(cpu_8080 *cpu)
+{
+    profiler_8080 p;
+    reset(cpu);
+    CHECK(profiler_begin(&p, cpu, MEM_SIZE, 0));
+
+    double deadline = seconds_now() + 20;
+    while (p.samples < MIN_SAMPLES && seconds_now() < deadline) {
+        run_8080(cpu, 1000000);
+        profiler_collect(&p);
+    }
+    CHECK(p.samples >= MIN_SAMPLES);
+
+    FILE *f = tmpfile();
+    u64 counts[STACK_COUNT] = {0}, matching = 0, dropped = 0;
+    CHECK(profiler_write_folded(&p, f));
+    u64 total = read_folded(f, counts, &matching, &dropped);
+    fclose(f);
+
+    // The two leaves take nearly all the time, 4:1 by their step counts.
+    CHECK(total == p.samples && dropped == 0);
+    CHECK(matching * 10 >= total * 9);
+    CHECK(counts[2] > counts[3] && counts[3] > 0);
+    CHECK((counts[2] + counts[3]) * 10 >= total * 9);
+    profiler_end(&p);
+}
+
+// With the ring full, the handler drops samples, and the folded output says how
+// many. The handler is called directly with the timer stopped.
+static void
+test_dropped(cpu_8080 *cpu)
+{
+    profiler_8080 p;
+    reset(cpu);
+    CHECK(profiler_begin(&p, cpu, MEM_SIZE, 0));
+    struct itimerval off = {0};
+    setitimer(ITIMER_PROF, &off, NULL);
+
+    u32 queued = p.ringHead - p.ringTail;
+    for (int i = 0; i < PROFILE_RING_SIZE + 3; ++i) profile_signal(SIGPROF);
+    CHECK(p.dropped == queued + 3);
+
+    FILE *f = tmpfile();
+    u64 counts[STACK_COUNT] = {0}, matching = 0, dropped = 0;
+    CHECK(profiler_write_folded(&p, f));
+    u64 total = read_folded(f, counts, &matching, &dropped);
+    fclose(f);
+    CHECK(total == PROFILE_RING_SIZE && dropped == p.dropped);
+    CHECK(counts[0] == PROFILE_RING_SIZE && matching == PROFILE_RING_SIZE);
+    profiler_end(&p);
+}
+
+int main(void)
+{
+    cpu_8080 cpu = {};
+    cpu.m = malloc(0x10000);
+
+    test_stacks(&cpu);
+    test_dropped(&cpu);
+
+    printf(failures ? "profile: %d checks failed\n" : "profile: ok\n", failures);
+    return failures ? 1 : 0;
+}
@@ -44,6 +44,29 @@ read_entire_file(const char *filepath)
     return result;
 }
 
+// Stands in for the CP/M BDOS the diagnostic calls at 0x0005 to print, and stops
+// when it jumps back to 0x0000 to exit.
+static int
+cpudiag_bdos(cpu_8080 *cpu)
+{
+    if (cpu->pc == 5) {
+        if (cpu->c == 9) {
+            u16 offset = (cpu->d << 8) | cpu->e;
+            u8 *str = &cpu->m[offset + 3]; //skip the prefix bytes
+            while (*str != '$') {
+                printf("%c", *str++);
+            }
+            printf("\n");
+            return 0;
+        } else if (cpu->c == 2) {
+            printf("print char routine called\n");
+        }
+    } else if (cpu->pc == 0 && cpu->steps > 0) {
+        return 0;
+    }
+    return 1;
+}
+
 int main(void)
 {
     struct read_file_result program = read_entire_file("cpudiag.bin");
@@ -64,10 +87,10 @@ int main(void)
     //  this 0x06 byte 112 in the code, which is
     //  byte 112 + 0x100 = 368 in memory
     cpu.m[368] = 0x7;
-    // Skip DAA test
-    cpu.m[0x59c] = 0xc3; // JMP
-    cpu.m[0x59d] = 0xc2; // addr byte 1
-    cpu.m[0x59e] = 0x05; // addr byte 2
+
+    // RET from the BDOS entry, cpudiag_bdos does the printing
+    cpu.m[5] = 0xc9;
+    cpu.trace = cpudiag_bdos;
 
     while (emulate_8080(&cpu)) {
         //print_state(&cpu);
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include "../c8080.c"
+#include "../c8080_timeline.c"
+
+// Reverse execution against straight forward runs. Build with
+// `gcc timeline.c -o timeline`, it prints the failed checks and exits with 1 if
+// there are any.
+//
+// The guest stores every IN 1 value into a ring at 0x2000-0x2fff, and the RST 1
+// handler counts interrupts at 0x3000. The host raises RST 1 every 37 steps.
+//
+//   0x008 PUSH PSW / LDA 0x3000 / INR A / STA 0x3000 / POP PSW / EI / RET
+//
+//   0x100 LXI SP,0x3f00
+//         LXI H,0x2000
+//         EI
+//   loop:
+//   0x107 IN 1 / MOV M,A / INX H
+//         MOV A,H / ANI 0x2f / MOV H,A
+//         ADD C / MOV C,A
+//         JMP loop
+static const u8 handler[] = { 0xf5, 0x3a, 0x00, 0x30, 0x3c, 0x32, 0x00, 0x30, 0xf1, 0xfb, 0xc9 };
+static const u8 program[] = {
+    0x31, 0x00, 0x3f, 0x21, 0x00, 0x20, 0xfb,
+    0xdb, 0x01, 0x77, 0x23, 0x7c, 0xe6, 0x2f, 0x67, 0x81, 0x4f, 0xc3, 0x07, 0x01,
+};
+
+#define MEM_SIZE 0x4000
+#define CHECKPOINT_SIZE (MEM_SIZE + sizeof(checkpoint_8080))
+#define HISTORY 20000
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+typedef struct machine {
+    cpu_8080 cpu;
+    io_log log;
+    u32 reads; // device state, IN returns something different every time
+} machine;
+
+static u8
+machine_in(cpu_8080 *cpu, u8 port)
+{
+    machine *mc = cpu->userData;
+    return (u8)((mc->reads++ * 0x9d) ^ port);
+}
+
+static void
+machine_init(machine *mc)
+{
+    u8 *m = mc->cpu.m ? mc->cpu.m : malloc(0x10000);
+    memset(mc, 0, sizeof(*mc));
+    memset(m, 0, 0x10000);
+    memcpy(m + 0x08, handler, sizeof(handler));
+    memcpy(m + 0x100, program, sizeof(program));
+    mc->cpu.m = m;
+    mc->cpu.pc = 0x100;
+    mc->cpu.in = machine_in;
+    mc->cpu.userData = mc;
+}
+
+// What the host does: raise an interrupt every 37 steps and step.
+static void
+host_run(machine *mc, timeline_8080 *tl, u64 to)
+{
+    cpu_8080 *cpu = &mc->cpu;
+    while (cpu->steps < to) {
+        if (cpu->steps % 37 == 0) interrupt_8080(cpu, 1);
+        if (tl) timeline_step(tl);
+        else emulate_8080(cpu);
+    }
+}
+
+// A fresh machine run straight to step. Recording into a log so it runs on the
+// same engine as the timeline.
+static void
+reference(machine *ref, u64 step)
+{
+    machine_init(ref);
+    io_log_record(&ref->cpu, &ref->log, NULL);
+    host_run(ref, NULL, step);
+    io_log_close(&ref->cpu, &ref->log);
+}
+
+static int
+same_state(cpu_8080 *a, cpu_8080 *b)
+{
+    return memcmp(a->r, b->r, sizeof(a->r)) == 0 && a->sp == b->sp && a->pc == b->pc &&
+           a->cc.z == b->cc.z && a->cc.s == b->cc.s && a->cc.p == b->cc.p && a->cc.cy == b->cc.cy &&
+           a->cc.ac == b->cc.ac && a->interruptEnabled == b->interruptEnabled && a->steps == b->steps &&
+           a->cycles == b->cycles && memcmp(a->m, b->m, MEM_SIZE) == 0;
+}
+
+static void
+check_at(machine *mc, machine *ref, u64 step)
+{
+    reference(ref, step);
+    CHECK(mc->cpu.steps == step);
+    if (!same_state(&mc->cpu, &ref->cpu)) {
+        printf("state differs from a straight run at step %llu\n", (unsigned long long)step);
+        failures++;
+    }
+}
+
+// Step before the last store to addr at or before step.
+static u64
+reference_last_write(machine *ref, u16 addr, u64 step, int *found)
+{
+    traps_8080 *traps = calloc(1, sizeof(traps_8080));
+    traps_set(traps, addr, TRAP_WRITE);
+    machine_init(ref);
+    io_log_record(&ref->cpu, &ref->log, NULL);
+    ref->cpu.traps = traps;
+
+    u64 last = 0;
+    *found = 0;
+    cpu_8080 *cpu = &ref->cpu;
+    while (cpu->steps < step) {
+        u64 before = cpu->steps;
+        host_run(ref, NULL, before + 1);
+        if (cpu->trapHit) {
+            cpu->trapHit = 0;
+            last = before;
+            *found = 1;
+        }
+    }
+    io_log_close(cpu, &ref->log);
+    free(traps);
+    return last;
+}
+
+static void
+test_history(machine *mc, machine *ref)
+{
+    timeline_8080 tl;
+    machine_init(mc);
+    CHECK(timeline_begin(&tl, &mc->cpu, MEM_SIZE, 24 * CHECKPOINT_SIZE, 64));
+    host_run(mc, &tl, HISTORY);
+    check_at(mc, ref, HISTORY);
+
+    // Thinned, but the log is small enough that the start is still there and the
+    // recent checkpoints are denser than the old ones.
+    CHECK(tl.count > 4 && tl.count <= 24);
+    CHECK(tl.checkpoints[0].steps == 0);
+    CHECK(tl.checkpoints[1].steps - tl.checkpoints[0].steps > tl.interval);
+    CHECK(tl.checkpoints[tl.count - 1].steps - tl.checkpoints[tl.count - 2].steps == tl.interval);
+
+    static const u64 targets[] = { 12345, 0, 1, 63, 64, 5000, HISTORY - 1, HISTORY };
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); ++i) {
+        CHECK(timeline_seek(&tl, targets[i]));
+        check_at(mc, ref, targets[i]);
+    }
+    CHECK(mc->cpu.log->mode == IO_LOG_RECORD);
+    CHECK(!timeline_seek(&tl, HISTORY + 1));
+
+    for (int i = 1; i <= 3; ++i) {
+        CHECK(timeline_reverse_step(&tl));
+        check_at(mc, ref, HISTORY - i);
+    }
+
+    // Stepping on from the past replays the log, then takes inputs and interrupts
+    // from the host again once it is back at the end of history.
+    CHECK(timeline_seek(&tl, HISTORY - 500));
+    host_run(mc, &tl, HISTORY + 3000);
+    CHECK(mc->cpu.log->mode == IO_LOG_RECORD);
+    check_at(mc, ref, HISTORY + 3000);
+
+    u64 head = mc->cpu.steps;
+    static const u16 addrs[] = { 0x3000, 0x2400, 0x2005 };
+    for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); ++i) {
+        int found;
+        u64 expected = reference_last_write(ref, addrs[i], head, &found);
+        CHECK(found);
+        CHECK(timeline_last_write(&tl, addrs[i]));
+        check_at(mc, ref, expected);
+        CHECK(timeline_seek(&tl, head));
+    }
+    CHECK(!timeline_last_write(&tl, 0x3800));
+    CHECK(mc->cpu.steps == head);
+
+    timeline_end(&tl);
+}
+
+// A guest that does nothing but IN. Checkpoints and log stay within the budget
+// by dropping the oldest history.
+static void
+test_log_budget(machine *mc)
+{
+    static const u8 poll[] = { 0xdb, 0x01, 0xc3, 0x00, 0x01 }; // IN 1 / JMP 0x100
+    size_t budget = 8 * CHECKPOINT_SIZE;
+    timeline_8080 tl;
+    machine_init(mc);
+    memcpy(mc->cpu.m + 0x100, poll, sizeof(poll));
+    CHECK(timeline_begin(&tl, &mc->cpu, MEM_SIZE, budget, 256));
+
+    size_t peak = 0;
+    while (mc->cpu.steps < 200000) {
+        timeline_step(&tl);
+        size_t used = tl.count * CHECKPOINT_SIZE + mc->cpu.log->capacity * sizeof(io_event);
+        if (used > peak) peak = used;
+    }
+    CHECK(peak <= budget);
+    CHECK(tl.checkpoints[0].steps > 0);
+
+    u64 oldest = tl.checkpoints[0].steps;
+    CHECK(!timeline_seek(&tl, oldest - 1));
+    CHECK(timeline_seek(&tl, oldest + 1));
+    // Every other step is an IN, the one that just ran was read number oldest / 2.
+    CHECK(mc->cpu.a == (u8)((oldest / 2) * 0x9d ^ 1));
+    CHECK(timeline_seek(&tl, 200000));
+    CHECK(mc->cpu.log->mode == IO_LOG_RECORD);
+
+    timeline_end(&tl);
+}
+
+// Time travel over a log recorded in the field. The replaying machine has no
+// devices, and has to keep taking its inputs from that log.
+static void
+test_field_log(machine *mc, machine *ref)
+{
+    const char *path = "timeline_test.log";
+    machine_init(ref);
+    CHECK(io_log_record(&ref->cpu, &ref->log, path));
+    host_run(ref, NULL, 8000);
+    io_log_close(&ref->cpu, &ref->log);
+
+    timeline_8080 tl;
+    machine_init(mc);
+    mc->cpu.in = NULL;
+    CHECK(io_log_replay(&mc->cpu, &mc->log, path));
+    CHECK(timeline_begin(&tl, &mc->cpu, MEM_SIZE, 24 * CHECKPOINT_SIZE, 64));
+    CHECK(mc->cpu.log == &mc->log);
+
+    host_run(mc, &tl, 5000);
+    check_at(mc, ref, 5000);
+    CHECK(timeline_seek(&tl, 1234));
+    check_at(mc, ref, 1234);
+    CHECK(timeline_seek(&tl, 5000));
+    CHECK(mc->cpu.log->mode == IO_LOG_REPLAY);
+    host_run(mc, &tl, 8000);
+    check_at(mc, ref, 8000);
+    CHECK(!mc->log.desync);
+
+    timeline_end(&tl);
+    io_log_close(&mc->cpu, &mc->log);
+    remove(path);
+}
+
+int main(void)
+{
+    machine mc = {0};
+    machine ref = {0};
+
+    test_history(&mc, &ref);
+    test_log_budget(&mc);
+    test_field_log(&mc, &ref);
+
+    printf(failures ? "timeline: %d checks failed\n" : "timeline: ok\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include "../c8080.c"
+
+// Breakpoint and watchpoint stops of run_8080. Build with `gcc traps.c -o traps`,
+// it prints the failed checks and exits with 1 if there are any.
+//
+// loop:
+//   0x100 INR A
+//   0x101 MOV B,A
+//   0x102 STA 0x2000
+//   0x105 JMP loop
+static const u8 program[] = { 0x3c, 0x47, 0x32, 0x00, 0x20, 0xc3, 0x00, 0x01 };
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+static void
+reset(cpu_8080 *cpu, traps_8080 *traps)
+{
+    u8 *m = cpu->m;
+    memset(cpu, 0, sizeof(*cpu));
+    memset(m, 0, 0x10000);
+    memset(traps, 0, sizeof(*traps));
+    memcpy(m + 0x100, program, sizeof(program));
+    cpu->m = m;
+    cpu->pc = 0x100;
+    cpu->sp = 0xf000;
+    cpu->traps = traps;
+}
+
+// Single stepping stops at the breakpoint once, the next step executes it.
+static void
+test_single_step(cpu_8080 *cpu, traps_8080 *traps)
+{
+    reset(cpu, traps);
+    traps_set(traps, 0x101, TRAP_EXEC);
+
+    int hits = 0;
+    for (int i = 0; i < 100; ++i) {
+        u64 steps = cpu->steps;
+        run_result r = run_8080(cpu, 1);
+        if (r.reason == STOP_BREAKPOINT) {
+            CHECK(r.addr == 0x101 && cpu->pc == 0x101 && cpu->steps == steps);
+            hits++;
+        } else {
+            CHECK(r.reason == STOP_STEP_LIMIT && cpu->steps == steps + 1);
+        }
+    }
+    // Every loop iteration is 4 steps and 1 stop.
+    CHECK(hits == 20);
+    CHECK(cpu->steps == 80 && cpu->a == 20);
+}
+
+// Resuming from a breakpoint runs it and stops there again on the next iteration.
+static void
+test_resume(cpu_8080 *cpu, traps_8080 *traps)
+{
+    reset(cpu, traps);
+    traps_set(traps, 0x101, TRAP_EXEC);
+
+    run_result r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_BREAKPOINT && r.addr == 0x101 && cpu->steps == 1);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_BREAKPOINT && r.addr == 0x101 && cpu->steps == 5);
+
+    // Moving the pc away and back isn't a resume of the reported stop.
+    cpu->pc = 0x100;
+    run_8080(cpu, 1);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_BREAKPOINT && cpu->steps == 6);
+}
+
+// A stop for another reason that leaves the pc on a breakpoint doesn't skip it.
+static void
+test_other_stops(cpu_8080 *cpu, traps_8080 *traps)
+{
+    reset(cpu, traps);
+    traps_set(traps, 0x101, TRAP_EXEC);
+    run_result r = run_8080(cpu, 1);
+    CHECK(r.reason == STOP_STEP_LIMIT && cpu->pc == 0x101);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_BREAKPOINT && r.addr == 0x101 && cpu->steps == 1);
+
+    reset(cpu, traps);
+    traps_set(traps, 0x105, TRAP_EXEC);
+    traps_set(traps, 0x2000, TRAP_WRITE);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_WATCH_WRITE && r.addr == 0x2000 && cpu->pc == 0x105 && cpu->steps == 3);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_BREAKPOINT && r.addr == 0x105 && cpu->steps == 3);
+    r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_WATCH_WRITE && cpu->steps == 7);
+}
+
+// interrupt_8080 pushes the return address through the watched store path, the
+// next run_8080 reports that before executing anything.
+static void
+test_pending_hit(cpu_8080 *cpu, traps_8080 *traps)
+{
+    reset(cpu, traps);
+    traps_set(traps, 0xefff, TRAP_WRITE);
+    cpu->interruptEnabled = 1;
+    CHECK(interrupt_8080(cpu, 1));
+
+    run_result r = run_8080(cpu, 1000);
+    CHECK(r.reason == STOP_WATCH_WRITE && r.addr == 0xefff && cpu->steps == 0 && cpu->pc == 0x08);
+    r = run_8080(cpu, 10);
+    CHECK(r.reason == STOP_STEP_LIMIT && cpu->steps == 10);
+}
+
+int main(void)
+{
+    cpu_8080 cpu = {};
+    cpu.m = malloc(0x10000);
+    traps_8080 *traps = malloc(sizeof(traps_8080));
+
+    test_single_step(&cpu, traps);
+    test_resume(&cpu, traps);
+    test_other_stops(&cpu, traps);
+    test_pending_hit(&cpu, traps);
+
+    printf(failures ? "traps: %d checks failed\n" : "traps: ok\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include "../c8080.c"
+#include "../c8080_timeline.c"
+#include "../c8080_visited.c"
+
+// State fingerprints and the visited set. Build with `gcc visited.c -o visited`,
+// it prints the failed checks and exits with 1 if there are any.
+//
+// The guest adds L into a walking window of 0x2000-0x2fff and uses the stack:
+//
+//   0x100 LXI SP,0x3f00
+//         LXI H,0x2000
+//   loop:
+//   0x106 MOV A,M / ADD L / MOV M,A / INX H
+//         MOV A,H / ANI 0x2f / MOV H,A
+//         PUSH B / POP B / INR B
+//         JMP loop
+static const u8 program[] = {
+    0x31, 0x00, 0x3f, 0x21, 0x00, 0x20,
+    0x7e, 0x85, 0x77, 0x23, 0x7c, 0xe6, 0x2f, 0x67,
+    0xc5, 0xc1, 0x04, 0xc3, 0x06, 0x01,
+};
+
+#define MEM_SIZE 0x4000
+
+static int failures;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+static void
+reset(cpu_8080 *cpu, state_hash_8080 *hash)
+{
+    u8 *m = cpu->m ? cpu->m : malloc(0x10000);
+    memset(cpu, 0, sizeof(*cpu));
+    memset(m, 0, 0x10000);
+    memcpy(m + 0x100, program, sizeof(program));
+    cpu->m = m;
+    cpu->pc = 0x100;
+    state_hash_attach(cpu, hash, MEM_SIZE);
+}
+
+static void
+run(cpu_8080 *cpu, u64 step)
+{
+    while (cpu->steps < step) emulate_8080(cpu);
+}
+
+// The incrementally updated fingerprint against hashing memory from scratch.
+static u64
+fresh_fingerprint(cpu_8080 *cpu)
+{
+    state_hash_8080 hash;
+    state_hash_8080 *old = cpu->hash;
+    state_hash_attach(cpu, &hash, old->memSize);
+    u64 fingerprint = state_fingerprint(cpu);
+    cpu->hash = old;
+    return fingerprint;
+}
+
+// Two machines that run the same code are in the same state after every step.
+static void
+test_equal(void)
+{
+    cpu_8080 a = {0}, b = {0};
+    state_hash_8080 hashA, hashB;
+    reset(&a, &hashA);
+    reset(&b, &hashB);
+    CHECK(state_fingerprint(&a) == state_fingerprint(&b));
+
+    int same = 1;
+    for (int i = 0; i < 20000; ++i) {
+        emulate_8080(&a);
+        emulate_8080(&b);
+        same &= state_fingerprint(&a) == state_fingerprint(&b);
+    }
+    CHECK(same);
+    CHECK(state_fingerprint(&a) == fresh_fingerprint(&a));
+    free(a.m);
+    free(b.m);
+}
+
+// Flipping any one part of the state changes the fingerprint, flipping it back
+// restores it.
+#define CHECK_CHANGES(cpu, base, field, value)            \
+    do {                                                  \
+        u64 old_ = (cpu)->field;                          \
+        (cpu)->field = (value);                           \
+        CHECK(state_fingerprint(cpu) != (base));          \
+        (cpu)->field = old_;                              \
+        CHECK(state_fingerprint(cpu) == (base));          \
+    } while (0)
+
+static void
+test_changes(void)
+{
+    cpu_8080 cpu = {0};
+    state_hash_8080 hash;
+    reset(&cpu, &hash);
+    run(&cpu, 1001);
+    u64 base = state_fingerprint(&cpu);
+
+    for (int i = 0; i < 7; ++i) {
+        CHECK_CHANGES(&cpu, base, r[i], cpu.r[i] ^ 0x01);
+        CHECK_CHANGES(&cpu, base, r[i], cpu.r[i] ^ 0x80);
+    }
+    CHECK_CHANGES(&cpu, base, cc.s, !cpu.cc.s);
+    CHECK_CHANGES(&cpu, base, cc.z, !cpu.cc.z);
+    CHECK_CHANGES(&cpu, base, cc.ac, !cpu.cc.ac);
+    CHECK_CHANGES(&cpu, base, cc.p, !cpu.cc.p);
+    CHECK_CHANGES(&cpu, base, cc.cy, !cpu.cc.cy);
+    CHECK_CHANGES(&cpu, base, interruptEnabled, !cpu.interruptEnabled);
+    CHECK_CHANGES(&cpu, base, halted, !cpu.halted);
+    CHECK_CHANGES(&cpu, base, sp, cpu.sp ^ 0x0001);
+    CHECK_CHANGES(&cpu, base, pc, cpu.pc ^ 0x8000);
+
+    // Memory changed by the host, at both ends of the hashed range.
+    static const u16 addrs[] = { 0x0000, 0x0107, 0x2000, 0x3eff, 0x3fff };
+    for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); ++i) {
+        cpu.m[addrs[i]] ^= 0x10;
+        state_hash_reset(&cpu);
+        CHECK(state_fingerprint(&cpu) != base);
+        cpu.m[addrs[i]] ^= 0x10;
+        state_hash_reset(&cpu);
+        CHECK(state_fingerprint(&cpu) == base);
+    }
+
+    // And by the guest: MOV M,A only changes the memory part.
+    while (cpu.pc != 0x108) emulate_8080(&cpu);
+    u16 hl = cpu.h << 8 | cpu.l;
+    u64 mem = hash.mem;
+    cpu.a = cpu.m[hl] ^ 0x10;
+    emulate_8080(&cpu);
+    CHECK(hash.mem != mem);
+    CHECK(state_fingerprint(&cpu) == fresh_fingerprint(&cpu));
+    free(cpu.m);
+}
+
+// Stores past memSize, from an instruction and from an interrupt pushing onto the
+// stack, leave the hash alone.
+static void
+test_outside(void)
+{
+    // MVI A,55h / STA 0x8000 / PUSH B
+    static const u8 stores[] = { 0x3e, 0x55, 0x32, 0x00, 0x80, 0xc5 };
+    cpu_8080 cpu = {0};
+    state_hash_8080 hash;
+    reset(&cpu, &hash);
+    memcpy(cpu.m + 0x100, stores, sizeof(stores));
+    state_hash_reset(&cpu);
+    cpu.sp = 0xf000;
+    cpu.b = 0x12;
+    cpu.interruptEnabled = 1;
+
+    u64 mem = hash.mem;
+    run(&cpu, 3);
+    CHECK(interrupt_8080(&cpu, 1));
+    CHECK(cpu.m[0x8000] == 0x55 && cpu.m[0xefff] == 0x12 && cpu.m[0xeffc] == 0x06);
+    CHECK(hash.mem == mem);
+    CHECK(state_fingerprint(&cpu) == fresh_fingerprint(&cpu));
+    free(cpu.m);
+}
+
+// Restoring a checkpoint rehashes memory, seeking back gives the fingerprint the
+// state had when it first ran.
+static void
+test_timeline(void)
+{
+    cpu_8080 cpu = {0};
+    state_hash_8080 hash;
+    timeline_8080 tl;
+    reset(&cpu, &hash);
+    CHECK(timeline_begin(&tl, &cpu, MEM_SIZE, 8 << 20, 1000));
+
+    u64 fingerprints[10000];
+    while (cpu.steps < 10000) {
+        fingerprints[cpu.steps] = state_fingerprint(&cpu);
+        timeline_step(&tl);
+    }
+
+    static const u64 seeks[] = { 2500, 0, 9999, 1000, 1001, 7777 };
+    for (size_t i = 0; i < sizeof(seeks) / sizeof(seeks[0]); ++i) {
+        CHECK(timeline_seek(&tl, seeks[i]));
+        CHECK(state_fingerprint(&cpu) == fingerprints[seeks[i]]);
+        CHECK(state_fingerprint(&cpu) == fresh_fingerprint(&cpu));
+    }
+    CHECK(timeline_reverse_step(&tl) && state_fingerprint(&cpu) == fingerprints[7776]);
+    timeline_end(&tl);
+    free(cpu.m);
+}
+
+// Enough fingerprints to grow the set a few times, the ones at i << 32 share their
+// low bits and probe, and 0, which can't be stored in a slot.
+static void
+test_set(void)
+{
+    visited_set set = {0};
+    CHECK(!visited_contains(&set, 0) && !visited_contains(&set, 1));
+    CHECK(visited_insert(&set, 0) == 1);
+    CHECK(visited_contains(&set, 0) && !visited_contains(&set, 1));
+    CHECK(visited_insert(&set, 0) == 0);
+    CHECK(visited_insert(&set, 1) == 1);
+    CHECK(visited_contains(&set, 1));
+
+    const u64 n = 10000;
+    int inserted = 1;
+    for (u64 i = 1; i <= n; ++i) {
+        inserted &= visited_insert(&set, hash_mix(i)) == 1;
+        inserted &= visited_insert(&set, i << 32) == 1;
+    }
+    CHECK(inserted);
+    CHECK(set.count == 2 * n + 2 && set.capacity > VISITED_MIN_CAPACITY);
+
+    int found = 1, absent = 1;
+    for (u64 i = 1; i <= n; ++i) {
+        found &= visited_contains(&set, hash_mix(i)) && visited_contains(&set, i << 32);
+        found &= visited_insert(&set, hash_mix(i)) == 0;
+        absent &= !visited_contains(&set, hash_mix(n + i)) && !visited_contains(&set, (n + i) << 32);
+    }
+    CHECK(found && absent);
+    CHECK(visited_contains(&set, 0) && visited_contains(&set, 1) && !visited_contains(&set, 2));
+    CHECK(set.count == 2 * n + 2);
+
+    visited_clear(&set);
+    CHECK(!visited_contains(&set, 0) && !visited_contains(&set, 1) && set.count == 0);
+    CHECK(visited_insert(&set, 1) == 1 && !visited_contains(&set, 0));
+    visited_clear(&set);
+}
+
+int main(void)
+{
+    test_equal();
+    test_changes();
+    test_outside();
+    test_timeline();
+    test_set();
+
+    printf(failures ? "visited: %d checks failed\n" : "visited: ok\n", failures);
+    return failures ? 1 : 0;
+}